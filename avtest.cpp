@@ -16,124 +16,509 @@
 #define ENABLE_BRAILLE 1
 #define USE_COLOR 1
 
-#include <array>
-#include <condition_variable>
+#include <algorithm>
 #include <string>
 #include <iostream>
 #include <iomanip>
 #include <vector>
 #include <thread>
-#include <queue>
-#include <atomic>
-#include <mutex>
+#include <ctime>
 
+#include "brv.h"
+#include "framepipeline.h"
 #include "image.h"
+#include "incremental.h"
+#include "output.h"
+#include "renderer.h"
+#include "rowpipeline.h"
+#include "scenedetector.h"
+#include "scheduler.h"
 #include "videodecoder.h"
 
-static constexpr uint32_t rescale_x = 2;
-static constexpr uint32_t rescale_y = 4;
+static constexpr uint32_t frame_width = 640;
+static constexpr uint32_t frame_height = 360;
 
-void print_img(const GImage& img)
+// Filled by the pipeline's workers, the display loop only turns the packed cells into escape sequences
+struct ProcessedFrame
 {
+    // Dithered frame, one bit per pixel
+    GBitImage bits;
+    std::vector<unsigned char> cells;
+    uint32_t columns = 0;
+    uint32_t rows = 0;
+    bool sceneCut = false;
+    uint32_t dirtyBlocks = 0;
+    // Too late to be shown when a worker picked it up, nothing else is set
+    bool dropped = false;
+};
+
+typedef FramePipeline<ProcessedFrame> Pipeline;
+
+struct Options
+{
+    std::filesystem::path file;
+    TerminalRenderer::ColorMode colorMode = USE_COLOR ? TerminalRenderer::ColorMode::TrueColor : TerminalRenderer::ColorMode::Mono;
+    uint32_t colorLevels = 32;
+    uint32_t colorTolerance = 0;
+    std::size_t maxFrameBytes = 0;
+    DiffusionKernel ditherKernel = DiffusionKernel::FloydSteinberg;
+    bool ordered = false;
+    OrderedPattern orderedPattern = OrderedPattern::Bayer8;
+    bool serpentine = false;
+    uint32_t ditherThreads = 1;
+    uint32_t otsuStep = 1;
+    double thresholdSmoothing = 0.2;
+    bool incremental = false;
+    uint32_t noiseLevel = 2;
+    Pipeline::Config pipeline;
+    VideoDecoder::DecoderConfig decoder;
+    bool headless = false;
+    double lateThreshold = 0.04;
+    std::size_t outputBuffers = 3;
+    // Sink specifications, the terminal if empty
+    std::vector<std::string> outputs;
+    std::chrono::microseconds spin{ 0 };
+    bool benchDecode = false;
+    bool decodeAudio = false;
+    // Writes a .brv file instead of playing the video
+    std::filesystem::path transcode;
+    uint32_t keyframeInterval = 60;
+    // Where .brv playback starts, in seconds
+    double start = 0;
+};
+
+static const char* discard_names[] = { "none", "nonref", "bidir", "nonintra", "nonkey", "all" };
+static const char* threading_names[] = { "auto", "frame", "slice", "none" };
+
+template<typename Enum, std::size_t N>
+static bool parse_enum(const std::string& value, const char* const (&names)[N], Enum& result)
+{
+    for (std::size_t i = 0; i < N; i++)
+    {
+        if (value == names[i])
+        {
+            result = static_cast<Enum>(i);
+            return true;
+        }
+    }
 
-#ifdef _WIN32
-    HANDLE console = GetStdHandle(STD_OUTPUT_HANDLE);
-    DWORD mode;
-    GetConsoleMode(console, &mode);
-    SetConsoleMode(console, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
-#endif
+    return false;
+}
 
-    std::stringstream strFrame;
-    strFrame << "\033[2;0H";
+static void print_decoder_config(std::ostream& out, const VideoDecoder& decoder)
+{
+    const auto& config = decoder.getDecoderConfig();
 
-#if USE_COLOR
-    uint32_t prevVal = 255;
-    uint32_t colorChanges = 0;
-#endif
+    out << "Decoder: " << decoder.getCodecName();
+
+    if (config.threading == VideoDecoder::Threading::None)
+        out << ", single threaded";
+    else
+        out << ", " << config.threads << " threads (" << threading_names[static_cast<int>(config.threading)] << " threading)";
+
+    out << ", loop filter skipped for: " << discard_names[static_cast<int>(config.skipLoopFilter)]
+        << ", lowres: " << config.lowres << std::endl;
+}
+
+static void print_usage(const std::string& program)
+{
+    std::cerr << "Usage: " << program << " [options] <filename>\n"
+              << "  A .brv file is played back as it is, only the output, pacing and color options apply\n"
+              << "  So is a recording made with --output=record:PATH, without dropping frames\n"
+              << "  --color=truecolor|256|16|mono  Color escape mode\n"
+              << "  --color-levels=N               Gray levels in truecolor mode (2-256, default 32)\n"
+              << "  --color-tolerance=N            Gray level error allowed to merge color runs (default 0)\n"
+              << "  --max-frame-bytes=N            Raise the color tolerance while frames exceed N bytes\n"
+              << "  --dither=floyd-steinberg|atkinson|sierra-lite|stucki|bayer4|bayer8|bayer16|blue-noise\n"
+              << "                                 Error diffusion kernel or ordered dither pattern (default floyd-steinberg)\n"
+              << "  --serpentine                   Alternate the scan direction every row\n"
+              << "  --dither-threads=N             Threads used for Floyd-Steinberg, 0 for all cores (default 1)\n"
+              << "  --otsu-step=N                  Pick the threshold from every N-th pixel and row (default 1)\n"
+              << "  --threshold-smoothing=A        Weight of the newest frame's threshold between scene cuts (0-1, default 0.2)\n"
+              << "  --incremental[=N]              Only reprocess blocks whose source changed by more than N per pixel (default 2)\n"
+              << "  --workers=N                    Frame processing threads, 0 for all cores (default 0)\n"
+              << "  --packet-queue=N               Demuxed packets buffered ahead of the decoder (default 64)\n"
+              << "  --frame-queue=N                Decoded frames buffered ahead of the workers (default 4)\n"
+              << "  --reorder-depth=N              Frames the workers may run ahead of the display, 0 for twice the workers (default 0)\n"
+              << "  --headless                     Process as fast as possible without output and report the throughput\n"
+              << "  --decoder-threads=N            Decoder threads, 0 lets libavcodec pick (default 0)\n"
+              << "  --decoder-threading=auto|frame|slice|none\n"
+              << "                                 Decoder threading type (default auto)\n"
+              << "  --skip-loop-filter=none|nonref|bidir|nonintra|nonkey|all\n"
+              << "                                 Frames decoded without the deblocking filter (default none)\n"
+              << "  --lowres=N                     Decode at 1/2^N of the size where the codec supports it (default 0)\n"
+              << "  --late-threshold=MS            Drop frames running more than MS behind, 0 shows every frame (default 40)\n"
+              << "  --output=tty|file:PATH|socket:PATH|record:PATH\n"
+              << "                                 Where frames go, may be repeated (default tty)\n"
+              << "  --output-buffers=N             Frames buffered for the terminal, frames are dropped while all are in use (default 3)\n"
+              << "  --spin=US                      Busy-wait the last US microseconds before each frame for steadier pacing (default 0)\n"
+              << "  --bench-decode                 Only demux and decode the video and report the time taken\n"
+              << "  --decode-audio                 Decode the audio stream too, it is discarded unused otherwise\n"
+              << "  --transcode=FILE.brv           Write the processed frames to a braille video instead of playing them\n"
+              << "  --keyframe-interval=N          Frames between forced keyframes of a braille video, 0 for scene cuts only (default 60)\n"
+              << "  --start=SECONDS                Start playing a braille video at the keyframe before SECONDS, a recording at SECONDS\n";
+}
+
+static std::unique_ptr<OutputSink> create_sink(const std::string& spec)
+{
+    const std::size_t colon = spec.find(':');
+    const std::string type = spec.substr(0, colon);
+    const std::filesystem::path path = colon == std::string::npos ? std::string() : spec.substr(colon + 1);
+
+    if (type == "file")
+        return std::make_unique<FileSink>(path);
+    else if (type == "socket")
+        return std::make_unique<SocketSink>(path);
+    else if (type == "record")
+        return std::make_unique<RecordingSink>(path);
+
+    return std::make_unique<TerminalSink>();
+}
+
+// The terminal unless other outputs were asked for, socket sinks are also added to sockets
+static std::vector<std::unique_ptr<OutputSink>> create_sinks(Options& options, std::vector<const SocketSink*>& sockets)
+{
+    std::vector<std::unique_ptr<OutputSink>> sinks;
+
+    if (options.outputs.empty())
+        options.outputs.emplace_back("tty");
+
+    for (const std::string& spec : options.headless ? std::vector<std::string>() : options.outputs)
+    {
+        sinks.push_back(create_sink(spec));
+
+        if (auto socket = dynamic_cast<const SocketSink*>(sinks.back().get()))
+            sockets.push_back(socket);
+    }
+
+    return sinks;
+}
+
+static void configure_renderer(TerminalRenderer& renderer, const Options& options)
+{
+    renderer.setColorMode(options.colorMode);
+    renderer.setColorLevels(options.colorLevels);
+    renderer.setColorTolerance(options.colorTolerance);
+    renderer.setFrameByteBudget(options.maxFrameBytes);
+    renderer.setBraille(ENABLE_BRAILLE);
+}
+
+static void print_output_stats(std::ostream& out, const OutputWriter& writer, const Options& options)
+{
+    const OutputWriter::Stats writerStats = writer.getStats();
+
+    out << std::fixed << std::setprecision(2)
+        << "Output: " << writerStats.bytes << " bytes, " << writerStats.frames << " frames in " << writerStats.batches << " batches"
+        << " to " << options.outputs.size() << " sinks, blocked on the sinks for " << std::chrono::duration<double>(writerStats.blockedTime).count() << "s"
+        << " (longest " << std::chrono::duration<double, std::milli>(writerStats.maxBlocked).count() << "ms)"
+        << ", backed up " << writerStats.backedUp << " times, display waited for a buffer " << writerStats.bufferWaits << " times" << std::endl;
+}
+
+static void print_lateness(std::ostream& out, const LatenessHistogram& lateness)
+{
+    out << std::fixed << std::setprecision(2)
+        << "Lateness: mean " << lateness.getMean() * 1000.0 << "ms, p50 " << lateness.percentile(0.5) * 1000.0
+        << "ms, p99 " << lateness.percentile(0.99) * 1000.0 << "ms, max " << lateness.getMax() * 1000.0 << "ms" << std::endl;
+
+    for (uint32_t i = 0; i < LatenessHistogram::BUCKETS; i++)
+    {
+        const uint64_t count = lateness.getBuckets()[i];
+        const double share = lateness.getCount() ? static_cast<double>(count) / static_cast<double>(lateness.getCount()) : 0;
+
+        if (i + 1 < LatenessHistogram::BUCKETS)
+            out << "  < " << std::setw(6) << std::right << LatenessHistogram::getLimit(i) * 1000.0 << "ms: ";
+        else
+            out << "  >= " << std::setw(5) << std::right << LatenessHistogram::getLimit(i - 1) * 1000.0 << "ms: ";
+
+        out << std::setw(7) << count << " " << std::string(static_cast<std::size_t>(share * 40.0 + 0.5), '#') << std::endl;
+    }
+}
+
+static bool parse_args(const std::vector<std::string>& args, Options& options)
+{
+    bool hasFile = false;
 
-    for (uint32_t y = 0; y < img.getHeight(); y += rescale_y)
+    for (const auto& arg : args)
     {
-        for (uint32_t x = 0; x < img.getWidth(); x += rescale_x)
+        if (arg.rfind("--", 0) != 0)
+        {
+            if (hasFile)
+                return false;
+
+            options.file = arg;
+            hasFile = true;
+            continue;
+        }
+
+        auto eq = arg.find('=');
+        std::string name = arg.substr(2, eq == std::string::npos ? std::string::npos : eq - 2);
+        std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+
+        if (name == "color")
         {
+            if (value == "truecolor")
+                options.colorMode = TerminalRenderer::ColorMode::TrueColor;
+            else if (value == "256")
+                options.colorMode = TerminalRenderer::ColorMode::Xterm256;
+            else if (value == "16")
+                options.colorMode = TerminalRenderer::ColorMode::Ansi16;
+            else if (value == "mono")
+                options.colorMode = TerminalRenderer::ColorMode::Mono;
+            else
+                return false;
+        }
+        else if (name == "color-levels")
+            options.colorLevels = std::stoul(value);
+        else if (name == "color-tolerance")
+            options.colorTolerance = std::stoul(value);
+        else if (name == "max-frame-bytes")
+            options.maxFrameBytes = std::stoul(value);
+        else if (name == "dither")
+        {
+            options.ordered = value == "bayer4" || value == "bayer8" || value == "bayer16" || value == "blue-noise";
+
+            if (value == "floyd-steinberg")
+                options.ditherKernel = DiffusionKernel::FloydSteinberg;
+            else if (value == "atkinson")
+                options.ditherKernel = DiffusionKernel::Atkinson;
+            else if (value == "sierra-lite")
+                options.ditherKernel = DiffusionKernel::SierraLite;
+            else if (value == "stucki")
+                options.ditherKernel = DiffusionKernel::Stucki;
+            else if (value == "bayer4")
+                options.orderedPattern = OrderedPattern::Bayer4;
+            else if (value == "bayer8")
+                options.orderedPattern = OrderedPattern::Bayer8;
+            else if (value == "bayer16")
+                options.orderedPattern = OrderedPattern::Bayer16;
+            else if (value == "blue-noise")
+                options.orderedPattern = OrderedPattern::BlueNoise;
+            else
+                return false;
+        }
+        else if (name == "serpentine")
+            options.serpentine = true;
+        else if (name == "dither-threads")
+            options.ditherThreads = std::stoul(value);
+        else if (name == "otsu-step")
+            options.otsuStep = std::max(std::stoul(value), 1ul);
+        else if (name == "threshold-smoothing")
+            options.thresholdSmoothing = std::stod(value);
+        else if (name == "incremental")
+        {
+            options.incremental = true;
 
-#if USE_COLOR
-            uint32_t value = 0;
+            if (!value.empty())
+                options.noiseLevel = std::stoul(value);
+        }
+        else if (name == "workers")
+            options.pipeline.workers = std::stoul(value);
+        else if (name == "packet-queue")
+            options.pipeline.packetQueueDepth = std::stoul(value);
+        else if (name == "frame-queue")
+            options.pipeline.frameQueueDepth = std::stoul(value);
+        else if (name == "reorder-depth")
+            options.pipeline.reorderDepth = std::stoul(value);
+        else if (name == "headless")
+            options.headless = true;
+        else if (name == "decoder-threads")
+            options.decoder.threads = std::stoul(value);
+        else if (name == "decoder-threading")
+        {
+            if (!parse_enum(value, threading_names, options.decoder.threading))
+                return false;
+        }
+        else if (name == "skip-loop-filter")
+        {
+            if (!parse_enum(value, discard_names, options.decoder.skipLoopFilter))
+                return false;
+        }
+        else if (name == "lowres")
+            options.decoder.lowres = std::stoul(value);
+        else if (name == "late-threshold")
+            options.lateThreshold = std::stod(value) / 1000.0;
+        else if (name == "output")
+        {
+            if (value != "tty" && value.rfind("file:", 0) != 0 && value.rfind("socket:", 0) != 0 && value.rfind("record:", 0) != 0)
+                return false;
+
+            options.outputs.push_back(value);
+        }
+        else if (name == "output-buffers")
+            options.outputBuffers = std::stoul(value);
+        else if (name == "spin")
+            options.spin = std::chrono::microseconds(std::stol(value));
+        else if (name == "bench-decode")
+            options.benchDecode = true;
+        else if (name == "decode-audio")
+            options.decodeAudio = true;
+        else if (name == "transcode" && !value.empty())
+            options.transcode = value;
+        else if (name == "keyframe-interval")
+            options.keyframeInterval = std::stoul(value);
+        else if (name == "start")
+            options.start = std::stod(value);
+        else
+            return false;
+    }
+
+    return hasFile;
+}
+
+// Streams a pre-rendered braille video from its memory mapping, nothing is decoded or dithered
+static int play_brv(Options& options)
+{
+    BrvReader reader(options.file);
+    const uint32_t columns = reader.getColumns();
+    const uint32_t rows = reader.getRows();
 
-            value += img[{x, y}];
-            value += img[{x, y + 1}];
-            value += img[{x, y + 2}];
-            value += img[{x + 1, y}];
-            value += img[{x + 1, y + 1}];
-            value += img[{x + 1, y + 2}];
-            value += img[{x, y + 3}];
-            value += img[{x + 1, y + 3}];
+    std::cerr << std::fixed << std::setprecision(2)
+              << "Braille video: " << columns << "x" << rows << " cells, " << reader.getFrameCount() << " frames, "
+              << reader.getKeyframeCount() << " keyframes, " << reader.getDuration() << "s" << std::endl;
 
-            auto avgVal = static_cast<uint32_t>(value / 8.0);
+    if (options.start > 0)
+        reader.seek(options.start);
 
-            constexpr uint32_t levels = 8;
+    TerminalRenderer renderer(2, 1, BRAILLE_WORKAROUND);
+    configure_renderer(renderer, options);
 
-            avgVal /= levels;
-            avgVal *= levels;
+    PlaybackScheduler scheduler(options.lateThreshold);
+    scheduler.setSpin(options.spin);
 
+    std::vector<const SocketSink*> sockets;
+    OutputWriter writer(create_sinks(options, sockets), options.outputBuffers);
+    writer.setBackpressureHandler([&scheduler] (bool backedUp) { scheduler.setBackpressure(backedUp); });
+    std::string headlessOutput;
 
-            if (prevVal != avgVal)
+    std::size_t totalBytes = 0;
+    uint64_t frames = 0;
+    auto startTime = std::chrono::steady_clock::now();
+    const std::clock_t cpuStart = std::clock();
+
+    while (const unsigned char* cells = reader.next())
+    {
+        const double frameTimestamp = reader.getTimestamp();
+
+        // Frames between the keyframe and the start only bring the cells up to date
+        if (frameTimestamp < options.start)
+            continue;
+
+        frames++;
+
+        if (!options.headless)
+        {
+            if (!scheduler.isStarted())
+                scheduler.start(frameTimestamp);
+
+            // Skipping a frame costs nothing, the renderer diffs against what it last sent
+            if (scheduler.shouldDrop(frameTimestamp))
             {
-                strFrame << "\033[38;2;" << avgVal << ";" << avgVal << ";" << avgVal << "m";
-                prevVal = avgVal;
-                colorChanges++;
+                scheduler.dropped(false);
+                continue;
             }
-#endif
+        }
 
-#if ENABLE_BRAILLE
-            uint32_t pattern = 0;
-            pattern += 0x01u & img[{x, y}];
-            pattern += 0x02u & img[{x, y + 1}];
-            pattern += 0x04u & img[{x, y + 2}];
-            pattern += 0x08u & img[{x + 1, y}];
-            pattern += 0x10u & img[{x + 1, y + 1}];
-            pattern += 0x20u & img[{x + 1, y + 2}];
-            pattern += 0x40u & img[{x, y + 3}];
-            pattern += 0x80u & img[{x + 1, y + 3}];
-
-#if BRAILLE_WORKAROUND
-            if (pattern == 0)
-                pattern = 0x01u;
-#endif
-            char c[4] = {0};
+        if (writer.takeKeyframeRequest())
+            renderer.invalidate();
 
-            pattern |= 0x2800u;
+        std::string& out = options.headless ? headlessOutput : writer.acquire();
+        out.clear();
 
-            // Some UTF-8 magic
-            c[0] = static_cast<char>((pattern >> 12u) + 0xE0u);
-            c[1] = static_cast<char>(((pattern >> 6u) & 0x3Fu) + 0x80u);
-            c[2] = static_cast<char>((pattern & 0x3Fu) + 0x80u);
+        const auto& renderStats = renderer.render(cells, columns, rows, out);
+        totalBytes += renderStats.bytes;
 
-#elif USE_COLOR
-            // Fall back to ASCII
-            char c = '@';
-#else
-            char c = (avgVal > UCHAR_MAX / 2) * '@' + (avgVal <= UCHAR_MAX / 2) * ' ';
-#endif
+        if (options.headless)
+            continue;
+
+        const LatenessHistogram& lateness = scheduler.getLateness();
+        char osd[160];
+        snprintf(osd, sizeof(osd), "\033[1;1H\033[38;2;20;200;255mFrame: %-10llu Seconds: %-10.2lf Dropped: %-8llu Late: p99 %.2lfms, max %.2lfms\033[38;2;255;255;255m",
+                 static_cast<unsigned long long>(reader.getFrameNumber()), frameTimestamp,
+                 static_cast<unsigned long long>(scheduler.getStats().droppedAtDisplay),
+                 lateness.percentile(0.99) * 1000.0, lateness.getMax() * 1000.0);
+        out += osd;
+
+        scheduler.waitFor(frameTimestamp);
+        scheduler.presented(frameTimestamp);
+        writer.submit(frameTimestamp, renderStats.fullRedraw);
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    double cpuSeconds = static_cast<double>(std::clock() - cpuStart) / CLOCKS_PER_SEC;
+    writer.flush();
+
+    std::cout << "\033[0m\n" << std::fixed << std::setprecision(2)
+              << "Frames: " << frames << " in " << seconds << "s (" << (seconds > 0 ? frames / seconds : 0.0) << " fps)"
+              << ", CPU time: " << cpuSeconds << "s, bytes written: " << totalBytes
+              << ", presented: " << scheduler.getStats().presented << ", dropped: " << scheduler.getStats().droppedAtDisplay << std::endl;
+
+    if (!options.headless)
+    {
+        print_output_stats(std::cout, writer, options);
+        print_lateness(std::cout, scheduler.getLateness());
+    }
+
+    return EXIT_SUCCESS;
+}
 
-            strFrame << c;
+// Recorded frames are deltas against the previous one, so none can be dropped, late frames are shown late
+static int play_recording(Options& options)
+{
+    RecordingReader reader(options.file);
+
+    PlaybackScheduler scheduler(0);
+    scheduler.setSpin(options.spin);
+
+    std::vector<const SocketSink*> sockets;
+    OutputWriter writer(create_sinks(options, sockets), options.outputBuffers);
+
+    OutputFrame frame;
+    std::size_t totalBytes = 0;
+    uint64_t frames = 0;
+    uint64_t keyframes = 0;
+    auto startTime = std::chrono::steady_clock::now();
+
+    while (reader.next(frame))
+    {
+        frames++;
+        keyframes += frame.keyframe;
+        totalBytes += frame.data.size();
+
+        if (options.headless)
+            continue;
+
+        // Frames before the start are written at once to bring the terminal up to date
+        if (frame.timestamp >= options.start)
+        {
+            if (!scheduler.isStarted())
+                scheduler.start(frame.timestamp);
+
+            scheduler.waitFor(frame.timestamp);
+            scheduler.presented(frame.timestamp);
         }
 
-        strFrame << '\n';
+        // Viewers joining later wait for a keyframe of the recording, none can be made
+        writer.takeKeyframeRequest();
+
+        // Hands the frame over without copying it, frame gets the writer's old buffer in exchange
+        writer.acquire().swap(frame.data);
+        writer.submit(frame.timestamp, frame.keyframe);
     }
 
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    writer.flush();
 
-#if USE_COLOR
-    strFrame << "\033[2;0H";
-    strFrame << "\033[38;2;20;200;255mColor changes: ";
-    uint32_t j = 0;
-    for (uint32_t i = 0; i < colorChanges; i += 100, j++)
-        strFrame << "#";
-    strFrame << "\033[38;2;0;0;0m";
-#endif
+    std::cout << "\033[0m\n" << std::fixed << std::setprecision(2)
+              << "Frames: " << frames << " (" << keyframes << " keyframes) in " << seconds << "s"
+              << ", bytes written: " << totalBytes << ", presented: " << scheduler.getStats().presented << std::endl;
 
-    std::cout << strFrame.str();
+    if (!options.headless)
+    {
+        print_output_stats(std::cout, writer, options);
+        print_lateness(std::cout, scheduler.getLateness());
+    }
 
-    std::cout << std::flush;
+    return EXIT_SUCCESS;
 }
 
 int main(int argc, char** argv)
@@ -141,124 +526,304 @@ int main(int argc, char** argv)
     std::string program = argv[0];
     std::vector<std::string> args(argv + 1, argv + argc);
 
-    if (args.size() != 1)
+    Options options;
+
+    try
     {
-        std::cerr << "Usage: " << program << " <filename>";
-        return EXIT_SUCCESS;
+        if (!parse_args(args, options))
+        {
+            print_usage(program);
+            return EXIT_SUCCESS;
+        }
     }
+    catch (std::logic_error& e)
+    {
+        print_usage(program);
+        return EXIT_FAILURE;
+    }
+
+    if (options.file.extension() == ".brv")
+        return play_brv(options);
+
+    if (RecordingReader::isRecording(options.file))
+        return play_recording(options);
+
+    std::filesystem::path file = options.file;
 
-    std::filesystem::path file = args[0];
+    VideoDecoder decoder(file, options.decoder);
+    decoder.setOutputSize(frame_width, frame_height, VideoDecoder::ScaleFilter::Bilinear);
+    print_decoder_config(std::cerr, decoder);
 
-    VideoDecoder decoder(file);
+    uint64_t audioSamples = 0;
 
-    struct QueueItem
+    // Nothing plays the audio yet, decoding it only measures what discarding it saves
+    if (options.decodeAudio && !decoder.setAudioConsumer([&audioSamples] (const AVFrame* audioFrame) { audioSamples += audioFrame->nb_samples; }))
+        std::cerr << "No audio stream to decode" << std::endl;
+
+    if (options.benchDecode)
     {
-        GImage* frame;
-        double pts;
-        double timeBase;
-        int currentBufferIdx;
-    };
+        VideoFrame frame;
+        uint64_t videoFrames = 0;
+        auto benchStart = std::chrono::steady_clock::now();
+
+        while (decoder.decodeFrame(frame))
+        {
+            if (decoder.hasFrame())
+                videoFrames++;
+        }
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - benchStart).count();
+
+        std::cout << std::fixed << std::setprecision(3)
+                  << "Decoded " << videoFrames << " video frames and " << audioSamples << " audio samples in " << seconds << "s ("
+                  << std::setprecision(2) << (seconds > 0 ? videoFrames / seconds : 0.0) << " fps)" << std::endl;
+
+        return EXIT_SUCCESS;
+    }
+
+    // Only touched between beginOrdered() and endOrdered(), one frame at a time, and declared
+    // before the pipeline so they outlive its threads
+    SceneDetector sceneDetector(options.thresholdSmoothing);
+    IncrementalProcessor incremental;
+    ErrorDiffuser incrementalDiffuser(options.ditherKernel, options.serpentine);
+    OrderedDitherer incrementalDitherer(options.orderedPattern);
+    incremental.setNoiseLevel(options.noiseLevel);
+    PlaybackScheduler scheduler(options.lateThreshold);
+    scheduler.setSpin(options.spin);
 
-    std::atomic_bool decodeFinished;
-    std::mutex queueMutex;
-    std::queue<QueueItem> queuedBuffers;
+    const double timeBase = decoder.getTimeBase();
 
-    std::mutex queueNotFullMutex;
-    std::condition_variable queueNotFull;
+    Pipeline pipeline(decoder, options.pipeline);
 
-    std::mutex queueNotEmptyMutex;
-    std::condition_variable queueNotEmpty;
+    pipeline.start([&] (Pipeline::Frame& frame) {
+        thread_local GImage img;
 
-    constexpr int nSwapBuffers = 8;
-    std::array<GImage, nSwapBuffers> frameBuffers;
+        const VideoFrame& source = frame.source;
+        ProcessedFrame& output = frame.result;
 
-    std::thread decodeThread([&] {
-        int frameBufferIdx = 0;
-        GImage img;
+        // Already too late to be shown, the state carried between frames is left untouched
+        output.dropped = scheduler.shouldDrop(frame.pts * timeBase);
 
-        while (true)
+        if (output.dropped)
         {
-            std::unique_lock<std::mutex> lock(queueNotFullMutex);
-            queueNotFull.wait(lock, [&queuedBuffers] { return queuedBuffers.size() < nSwapBuffers - 1; });
+            // The slot still holds the flags of the frame that used it before
+            output.sceneCut = false;
+            output.dirtyBlocks = 0;
 
-            std::unique_lock<std::mutex> queueLock(queueMutex);
+            // Its ordered turn is passed on by the pipeline
+            return;
+        }
 
-            if (!decoder.decodeFrame(img))
-                break;
+        // YUV frames come straight from the decoder's Y plane at full size and usually limited range,
+        // the range expansion is folded into the gamma LUT and resize() is a no-op for swscale'd frames
+        static const GImage::LUT gammaLut = GImage::gamma_lut(2.2);
+        static const GImage::LUT limitedGammaLut = GImage::compose_lut(GImage::limited_range_lut(), gammaLut);
+        const GImage::LUT& lut = source.isLimitedRange() ? limitedGammaLut : gammaLut;
 
-            if (decoder.hasFrame())
-            {
-                std::uint32_t width = 96;
-                std::uint32_t height = 60 / 2;
+        if (options.incremental)
+        {
+            // Every frame is diffed against the previous one, so the whole frame runs in order
+            pipeline.beginOrdered(frame);
 
-                width *= rescale_x;
-                height *= rescale_y;
+            // Blocks whose source did not change keep their previous output
+            incremental.update(source.getLuma(), lut, frame_width, frame_height);
 
-                static int i = 0;
+            const auto& scene = sceneDetector.update(incremental.getImage().getHistogram(options.otsuStep));
 
-                img.gamma_correct(2.2);
-                int threshold = img.otsu();
-                frameBuffers[frameBufferIdx] = std::move(img.resize_bilinear(640, 360).dither(threshold));
+            if (options.ordered)
+                incremental.dither(incrementalDitherer, scene.threshold);
+            else
+                incremental.dither(incrementalDiffuser, scene.threshold);
 
-                queuedBuffers.push({
-                   &frameBuffers[frameBufferIdx],
-                   decoder.getPTS(),
-                   decoder.getTimeBase(),
-                   frameBufferIdx
-                });
+            output.bits.pack(incremental.getOutput().view());
 
-                queueNotEmpty.notify_all();
+            output.sceneCut = scene.cut;
+            output.dirtyBlocks = incremental.getDirtyBlockCount();
 
-                frameBufferIdx++;
-                frameBufferIdx %= nSwapBuffers;
+            pipeline.endOrdered(frame);
+        }
+        else
+        {
+            RowPipeline(source.getLuma()).lut(lut).resize(frame_width, frame_height).run(img);
+
+            // Taken from the downscaled frame, subsampling further is usually just as good
+            const GImage::Histogram histogram = img.getHistogram(options.otsuStep);
+
+            // The threshold is smoothed over the previous frames, only this part has to wait for them
+            pipeline.beginOrdered(frame);
+            const SceneDetector::Result scene = sceneDetector.update(histogram);
+            pipeline.endOrdered(frame);
+
+            if (options.ordered)
+            {
+                kernels::dither_ordered(img.view(), output.bits, scene.threshold, options.orderedPattern);
+            }
+            // The wavefront only supports plain left to right Floyd-Steinberg
+            else if (options.ditherThreads == 1 || options.ditherKernel != DiffusionKernel::FloydSteinberg || options.serpentine)
+            {
+                kernels::dither(img.view(), output.bits, scene.threshold, options.ditherKernel, options.serpentine);
+            }
+            else
+            {
+                kernels::dither(img.view(), output.bits, scene.threshold, options.ditherThreads);
             }
+
+            output.sceneCut = scene.cut;
+            output.dirtyBlocks = 0;
         }
 
-        decodeFinished = true;
+        output.columns = BrailleEncoder::cellsPerRow(output.bits.getWidth());
+        output.rows = BrailleEncoder::cellRows(output.bits.getHeight());
+        output.cells.resize(static_cast<std::size_t>(output.columns) * output.rows);
+        BrailleEncoder::encodeImage(output.bits, output.cells.data());
     });
 
-    auto startTime = std::chrono::high_resolution_clock::now();
+    // The scheduler is never started, so no frame is dropped
+    if (!options.transcode.empty())
+    {
+        BrvWriter brv(options.transcode, BrailleEncoder::cellsPerRow(frame_width), BrailleEncoder::cellRows(frame_height), options.keyframeInterval);
+        auto transcodeStart = std::chrono::steady_clock::now();
+
+        while (Pipeline::Frame* frame = pipeline.front())
+        {
+            // A delta across a scene cut would be about as large as a keyframe
+            brv.write(frame->result.cells.data(), frame->pts * timeBase, frame->result.sceneCut);
+            pipeline.pop();
+        }
+
+        brv.finish();
 
-    while (true)
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - transcodeStart).count();
+        const uint64_t frames = brv.getFrameCount();
+
+        std::cout << std::fixed << std::setprecision(2)
+                  << "Transcoded " << frames << " frames in " << seconds << "s (" << (seconds > 0 ? frames / seconds : 0.0) << " fps)"
+                  << ", " << brv.getKeyframeCount() << " keyframes, " << brv.getBytes() << " bytes"
+                  << " (" << (frames ? brv.getBytes() / frames : 0) << " per frame, "
+                  << BrailleEncoder::cellsPerRow(frame_width) * BrailleEncoder::cellRows(frame_height) << " cells)" << std::endl;
+
+        return EXIT_SUCCESS;
+    }
+
+    // Only the changed cells are sent, the frame starts right below the OSD line
+    TerminalRenderer renderer(2, 1, BRAILLE_WORKAROUND);
+    configure_renderer(renderer, options);
+
+    std::size_t totalBytes = 0;
+    std::size_t totalSaved = 0;
+    uint64_t sceneCuts = 0;
+
+    uint32_t skipLevel = 0;
+
+    // Frames are written on a thread of their own, a terminal that can not keep up makes the scheduler drop frames
+    std::vector<const SocketSink*> sockets;
+    OutputWriter writer(create_sinks(options, sockets), options.outputBuffers);
+    writer.setBackpressureHandler([&scheduler] (bool backedUp) { scheduler.setBackpressure(backedUp); });
+    std::string headlessOutput;
+
+    auto startTime = std::chrono::steady_clock::now();
+
+    while (Pipeline::Frame* frame = pipeline.front())
     {
-        std::unique_lock<std::mutex> lock(queueNotEmptyMutex);
-        queueNotEmpty.wait(lock, [&] { return !queuedBuffers.empty() || decodeFinished; });
-        std::unique_lock<std::mutex> queueLock(queueMutex);
+        const ProcessedFrame& item = frame->result;
 
-        if (decodeFinished && queuedBuffers.empty())
-            break;
+        double frameTimestamp = frame->pts * timeBase;
 
-        auto& item = queuedBuffers.front();
+        // Under sustained overload dropping after decoding is not enough
+        if (scheduler.getSkipLevel() != skipLevel)
+        {
+            static constexpr VideoDecoder::Discard skipLevels[] = {
+                VideoDecoder::Discard::None, VideoDecoder::Discard::NonReference, VideoDecoder::Discard::NonKey
+            };
 
-        double frameTimestamp = item.pts * item.timeBase;
+            skipLevel = scheduler.getSkipLevel();
+            decoder.setFrameSkip(skipLevels[skipLevel]);
+        }
+
+        if (!options.headless)
+        {
+            if (!scheduler.isStarted())
+                scheduler.start(frameTimestamp);
+
+            // Either a worker dropped it, it got late waiting for the display or the terminal is behind
+            if (item.dropped || scheduler.shouldDrop(frameTimestamp))
+            {
+                scheduler.dropped(item.dropped);
+                pipeline.pop();
+                continue;
+            }
+        }
+
+        // Nothing of the previous scene is worth keeping
+        if (item.sceneCut)
+        {
+            renderer.invalidate();
+            sceneCuts++;
+        }
+
+        // A viewer joined or fell behind and needs a frame to start from
+        if (writer.takeKeyframeRequest())
+            renderer.invalidate();
+
+        std::string& out = options.headless ? headlessOutput : writer.acquire();
+        out.clear();
 
         auto frameStart = std::chrono::steady_clock::now();
-        print_img(*item.frame);
+        const auto& renderStats = renderer.render(item.cells.data(), item.columns, item.rows, out);
+        totalBytes += renderStats.bytes;
+        totalSaved += renderStats.saved();
         auto frameEnd = std::chrono::steady_clock::now();
 
+        if (options.headless)
+        {
+            pipeline.pop();
+            continue;
+        }
+
+        const OutputWriter::Stats writerStats = writer.getStats();
         std::stringstream infoOSD;
 
         static int frameNumber = 0;
         char frameNum[32];
         snprintf(frameNum, sizeof(frameNum), "Frame number: %d", frameNumber++);
         char ptsNum[32];
-        snprintf(ptsNum, sizeof(ptsNum), "PTS: %.2lf", item.pts);
+        snprintf(ptsNum, sizeof(ptsNum), "PTS: %.2lf", frame->pts);
         char secondsNum[32];
         snprintf(secondsNum, sizeof(secondsNum), "Seconds: %.2lf", frameTimestamp);
         char realtime[32];
-        auto now = std::chrono::high_resolution_clock::now();
-        auto timeDiff = std::chrono::duration_cast<std::chrono::microseconds>(now - startTime).count();
-        snprintf(realtime, sizeof(realtime), "Real time: %.2lf", static_cast<double>(timeDiff) / 1000000.0);
+        snprintf(realtime, sizeof(realtime), "Real time: %.2lf", std::chrono::duration<double>(frameEnd - startTime).count());
         char timeBaseStr[32];
-        snprintf(timeBaseStr, sizeof(timeBaseStr), "1/Time base: %g", 1 / item.timeBase);
+        snprintf(timeBaseStr, sizeof(timeBaseStr), "1/Time base: %g", 1 / timeBase);
         char bufCount[32];
-        snprintf(bufCount, sizeof(bufCount), "Buffer: %lu", queuedBuffers.size());
-        char curBuf[32];
-        snprintf(curBuf, sizeof(curBuf), "Current buffer: %d", item.currentBufferIdx);
-        auto printDuration = frameEnd - frameStart;
-        long frameTime = std::chrono::duration_cast<std::chrono::milliseconds>(printDuration).count();
+        snprintf(bufCount, sizeof(bufCount), "Buffer: %zu/%zu", pipeline.size(), pipeline.capacity());
+        char workersStr[32];
+        snprintf(workersStr, sizeof(workersStr), "Workers: %u", pipeline.getConfig().workers);
         char frameTimeStr[32];
-        snprintf(frameTimeStr, sizeof(frameTimeStr), "Frame time: %ldms", frameTime);
+        snprintf(frameTimeStr, sizeof(frameTimeStr), "Frame time: %.2lfms", std::chrono::duration<double, std::milli>(frameEnd - frameStart).count());
+        const LatenessHistogram& lateness = scheduler.getLateness();
+        char latenessStr[48];
+        snprintf(latenessStr, sizeof(latenessStr), "Late: p50 %.2lfms, p99 %.2lfms, max %.2lfms",
+                 lateness.percentile(0.5) * 1000.0, lateness.percentile(0.99) * 1000.0, lateness.getMax() * 1000.0);
+        char colorChangesStr[32];
+        snprintf(colorChangesStr, sizeof(colorChangesStr), "Color changes: %u", renderStats.colorChanges);
+        char sceneCutsStr[32];
+        snprintf(sceneCutsStr, sizeof(sceneCutsStr), "Scene cuts: %llu", static_cast<unsigned long long>(sceneCuts));
+        char dirtyStr[32];
+        snprintf(dirtyStr, sizeof(dirtyStr), "Dirty blocks: %u", item.dirtyBlocks);
+        char droppedStr[32];
+        snprintf(droppedStr, sizeof(droppedStr), "Dropped: %llu%s",
+                 static_cast<unsigned long long>(scheduler.getStats().droppedBeforeProcessing + scheduler.getStats().droppedAtDisplay),
+                 skipLevel ? (skipLevel == 1 ? " (skip nonref)" : " (keyframes)") : "");
+        char blockedStr[48];
+        snprintf(blockedStr, sizeof(blockedStr), "TTY blocked: %.2lfs%s",
+                 std::chrono::duration<double>(writerStats.blockedTime).count(), writer.isBackedUp() ? " (backed up)" : "");
+        std::size_t viewers = 0;
+        for (const SocketSink* socket : sockets)
+            viewers += socket->getViewers();
+        char viewersStr[32];
+        snprintf(viewersStr, sizeof(viewersStr), "Viewers: %zu", viewers);
+        char bytesStr[48];
+        snprintf(bytesStr, sizeof(bytesStr), "Sent: %zuB, saved: %zuB%s", renderStats.bytes, renderStats.saved(), renderStats.fullRedraw ? " (full)" : "");
 
         infoOSD << "\033[1;1H";
         infoOSD << "\033[38;2;20;200;255m";
@@ -268,20 +833,59 @@ int main(int argc, char** argv)
                 << std::setw(32) << std::left << realtime
                 << std::setw(32) << std::left << timeBaseStr
                 << std::setw(24) << std::left << bufCount
-                << std::setw(24) << std::left << curBuf
-                << std::setw(24) << std::left << frameTimeStr;
+                << std::setw(24) << std::left << workersStr
+                << std::setw(24) << std::left << frameTimeStr
+                << std::setw(24) << std::left << colorChangesStr
+                << std::setw(24) << std::left << sceneCutsStr
+                << std::setw(24) << std::left << (options.incremental ? dirtyStr : "")
+                << std::setw(28) << std::left << droppedStr
+                << std::setw(48) << std::left << latenessStr
+                << std::setw(36) << std::left << blockedStr
+                << std::setw(16) << std::left << (sockets.empty() ? "" : viewersStr)
+                << std::setw(48) << std::left << bytesStr;
         infoOSD << "\033[38;2;255;255;255m";
-        std::cout << infoOSD.str() << std::flush;
+        out += infoOSD.str();
 
-        queuedBuffers.pop();
-        queueLock.unlock();
-        lock.unlock();
-        queueNotFull.notify_all();
+        // Rendered ahead of its deadline, only handing it to the writer waits for it
+        scheduler.waitFor(frameTimestamp);
+        scheduler.presented(frameTimestamp);
+        writer.submit(frameTimestamp, renderStats.fullRedraw);
 
-        long expectedIdleUs = static_cast<long>(frameTimestamp * 1000000.0 - timeDiff) - frameTime * 1000;
-        expectedIdleUs = std::max(expectedIdleUs, 1000L);
-        std::this_thread::sleep_for(std::chrono::microseconds(expectedIdleUs));
+        pipeline.pop();
     }
 
-    decodeThread.join();
-}
+    auto endTime = std::chrono::steady_clock::now();
+    writer.flush();
+
+    std::cout << "\033[0m\n";
+    std::cout << "Bytes written: " << totalBytes << ", saved by delta frames: " << totalSaved
+              << ", scene cuts: " << sceneCuts << std::endl;
+
+    auto pipelineStats = pipeline.getStats();
+    auto packetStats = pipeline.getPacketStats();
+    double seconds = std::chrono::duration<double>(endTime - startTime).count();
+
+    std::cout << std::fixed << std::setprecision(2)
+              << "Frames: " << pipelineStats.frames << " in " << seconds << "s (" << (seconds > 0 ? pipelineStats.frames / seconds : 0.0) << " fps)"
+              << " on " << pipeline.getConfig().workers << " workers"
+              << ", decoder stalls: " << pipelineStats.decoderStalls
+              << ", display stalls: " << pipelineStats.consumerStalls
+              << ", most frames reordered: " << pipelineStats.maxReordered
+              << ", packets: " << packetStats.items << ", demuxer stalls: " << packetStats.fullWaits << std::endl;
+
+    const auto& schedulerStats = scheduler.getStats();
+
+    std::cout << "Presented: " << schedulerStats.presented
+              << ", dropped late: " << schedulerStats.droppedBeforeProcessing << " before processing, "
+              << schedulerStats.droppedAtDisplay << " at display"
+              << ", decoder skip level raised " << schedulerStats.skipEngaged << " times"
+              << ", frames skipped by the decoder: " << decoder.getSkippedFrames() << std::endl;
+
+    if (!options.headless)
+    {
+        print_output_stats(std::cout, writer, options);
+        print_lateness(std::cout, scheduler.getLateness());
+    }
+
+    print_decoder_config(std::cout, decoder);
+}
\ No newline at end of file
@@ -0,0 +1,235 @@
+#include "batch.h"
+
+#include "reorderwindow.h"
+#include "rowpipeline.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+namespace
+{
+    // Terminal cells are about twice as high as wide, so every other cell row of the dithered image is shown
+    constexpr uint32_t aspect0 = 12;
+    constexpr uint32_t aspect1 = 24;
+
+    void write_file(const std::filesystem::path& path, const std::string& text)
+    {
+        std::ofstream file(path, std::ios::binary);
+
+        if (!file.write(text.data(), static_cast<std::streamsize>(text.size())))
+            throw std::runtime_error("Could not write " + path.string());
+    }
+}
+
+BatchConverter::BatchConverter(const Config& configIn) : config(configIn)
+{
+    if (!this->config.settings.width)
+        throw std::invalid_argument("The output width must not be 0");
+
+    if (!this->config.jobs)
+        this->config.jobs = std::max(std::thread::hardware_concurrency(), 1u);
+
+    if (!this->config.maxInFlight)
+        this->config.maxInFlight = 2 * static_cast<std::size_t>(this->config.jobs);
+
+    // Every worker needs a slot of its own to write to
+    this->config.maxInFlight = std::max<std::size_t>(this->config.maxInFlight, this->config.jobs);
+}
+
+const BatchConverter::Config& BatchConverter::getConfig() const
+{
+    return this->config;
+}
+
+void BatchConverter::convert(const GImage& img, const Settings& settings, Result& result)
+{
+    thread_local GBitImage bits;
+    thread_local std::vector<unsigned char> cells;
+    static const BrailleEncoder encoder(true);
+
+    if (!settings.width)
+        throw std::invalid_argument("The output width must not be 0");
+
+    uint32_t height = settings.height;
+
+    // Kept within the largest image for very tall sources
+    if (!height)
+        height = static_cast<uint32_t>(std::clamp<uint64_t>((static_cast<uint64_t>(settings.width) * img.getHeight() + img.getWidth() / 2) / img.getWidth(),
+                                                            1, GImage::MAX_SIZE / BrailleEncoder::CELL_HEIGHT));
+
+    const unsigned char threshold = settings.fixedThreshold ? settings.threshold : img.otsu();
+
+    RowPipeline pipeline(img);
+    pipeline.resize(settings.width * BrailleEncoder::CELL_WIDTH, height * BrailleEncoder::CELL_HEIGHT);
+
+    switch (settings.algorithm)
+    {
+        case Algorithm::Threshold:
+            pipeline.binary_threshold(threshold);
+            break;
+        case Algorithm::Diffusion:
+            pipeline.dither(threshold, settings.kernel, settings.serpentine);
+            break;
+        case Algorithm::Ordered:
+            pipeline.dither_ordered(threshold, settings.pattern);
+            break;
+    }
+
+    pipeline.run(bits);
+
+    const uint32_t columns = BrailleEncoder::cellsPerRow(bits.getWidth());
+    const uint32_t rows = bits.getHeight() / BrailleEncoder::CELL_HEIGHT * aspect0 / aspect1;
+    const std::size_t rowBytes = static_cast<std::size_t>(columns) * BrailleEncoder::GLYPH_BYTES + 1;
+
+    cells.resize(columns);
+    result.text.resize(rows * rowBytes);
+    char* out = result.text.data();
+
+    for (uint32_t y = 0; y < rows; y++)
+    {
+        BrailleEncoder::encodeCells(bits, y * aspect1 / aspect0 * BrailleEncoder::CELL_HEIGHT, cells.data());
+
+        out += encoder.writeGlyphs(cells.data(), columns, out);
+        *out++ = '\n';
+    }
+
+    result.width = bits.getWidth();
+    result.height = bits.getHeight();
+    result.threshold = threshold;
+}
+
+BatchConverter::Stats BatchConverter::run(const std::vector<std::filesystem::path>& files, std::ostream& out, std::ostream& errors)
+{
+    struct Slot
+    {
+        bool failed = false;
+        std::string error;
+        Result result;
+    };
+
+    const auto begin = std::chrono::steady_clock::now();
+    const bool perFile = !this->config.outputDirectory.empty();
+
+    auto outputPath = [&] (std::size_t index) {
+        return this->config.outputDirectory / files[index].stem().concat(".txt");
+    };
+
+    // Index of the first input writing to the same file, later ones fail instead of overwriting it
+    std::vector<std::size_t> nameOwner(files.size());
+
+    if (perFile)
+    {
+        std::filesystem::create_directories(this->config.outputDirectory);
+
+        std::map<std::filesystem::path, std::size_t> owners;
+
+        for (std::size_t i = 0; i < files.size(); i++)
+            nameOwner[i] = owners.emplace(outputPath(i), i).first->second;
+    }
+
+    std::mutex mutex;
+    std::condition_variable slotFree;
+    std::condition_variable slotDone;
+    // Slots keep their text buffers from one image to the next
+    ReorderWindow<Slot> window(this->config.maxInFlight);
+    std::size_t next = 0;
+
+    auto work = [&] {
+        while (true)
+        {
+            std::size_t index;
+
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+
+                slotFree.wait(lock, [&] {
+                    return next >= files.size() || window.admits(next);
+                });
+
+                if (next >= files.size())
+                    return;
+
+                index = next++;
+            }
+
+            Slot& slot = window.at(index);
+            slot.failed = false;
+
+            try
+            {
+                if (perFile && nameOwner[index] != index)
+                    throw std::runtime_error("Same output file as " + files[nameOwner[index]].string() + ": " + outputPath(index).string());
+
+                const GImage img(files[index]);
+                convert(img, this->config.settings, slot.result);
+
+                if (perFile)
+                    write_file(outputPath(index), slot.result.text);
+            }
+            catch (std::exception& e)
+            {
+                slot.failed = true;
+                slot.error = e.what();
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                window.complete(index);
+            }
+
+            slotDone.notify_one();
+        }
+    };
+
+    std::vector<std::thread> threads;
+
+    for (uint32_t i = 0; i < std::min<std::size_t>(this->config.jobs, files.size()); i++)
+        threads.emplace_back(work);
+
+    Stats stats;
+
+    for (std::size_t i = 0; i < files.size(); i++)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            slotDone.wait(lock, [&] { return window.ready(); });
+        }
+
+        const Slot& slot = window.front();
+
+        if (slot.failed)
+        {
+            errors << files[i].string() << ": " << slot.error << std::endl;
+            stats.failed++;
+        }
+        else
+        {
+            if (!perFile)
+                out.write(slot.result.text.data(), static_cast<std::streamsize>(slot.result.text.size()));
+
+            stats.images++;
+            stats.bytes += slot.result.text.size();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            window.pop();
+        }
+
+        slotFree.notify_all();
+    }
+
+    for (std::thread& thread : threads)
+        thread.join();
+
+    out.flush();
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    return stats;
+}
\ No newline at end of file
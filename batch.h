@@ -0,0 +1,90 @@
+#ifndef PNG2BR_BATCH_H
+#define PNG2BR_BATCH_H
+
+#include "braille.h"
+#include "image.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/*
+ * Converts many images to braille text on a pool of threads.
+ *
+ * Workers pick files up in input order but may finish them in any order,
+ * and the caller's thread writes the results in input order. A
+ * ReorderWindow bounds memory: workers never get more than maxInFlight
+ * images ahead of the writer, and each one holds one decoded image at a
+ * time.
+ */
+class BatchConverter
+{
+    public:
+        enum class Algorithm
+        {
+            Threshold,
+            Diffusion,
+            Ordered
+        };
+
+        // How a single image is converted
+        struct Settings
+        {
+            // Output size in cells, a height of 0 keeps the aspect ratio of the image
+            uint32_t width = 80;
+            uint32_t height = 0;
+            Algorithm algorithm = Algorithm::Threshold;
+            DiffusionKernel kernel = DiffusionKernel::FloydSteinberg;
+            bool serpentine = false;
+            OrderedPattern pattern = OrderedPattern::Bayer8;
+            // Picked with Otsu's method on the source image when not set
+            bool fixedThreshold = false;
+            unsigned char threshold = 128;
+        };
+
+        struct Config
+        {
+            Settings settings;
+            // 0 for all cores
+            uint32_t jobs = 0;
+            // Converted images waiting to be written, 0 for twice the jobs
+            std::size_t maxInFlight = 0;
+            // Where each image goes as <stem>.txt, empty to concatenate them all on the output stream.
+            // Inputs whose name is already taken by an earlier one fail
+            std::filesystem::path outputDirectory;
+        };
+
+        struct Result
+        {
+            std::string text;
+            // Size of the dithered image in pixels
+            uint32_t width = 0;
+            uint32_t height = 0;
+            unsigned char threshold = 0;
+        };
+
+        struct Stats
+        {
+            uint64_t images = 0;
+            uint64_t failed = 0;
+            std::size_t bytes = 0;
+            double seconds = 0;
+        };
+
+        explicit BatchConverter(const Config& configIn);
+
+        // Converts files, reporting the ones that fail on errors and carrying on with the rest
+        Stats run(const std::vector<std::filesystem::path>& files, std::ostream& out, std::ostream& errors);
+
+        [[nodiscard]] const Config& getConfig() const;
+
+        static void convert(const GImage& img, const Settings& settings, Result& result);
+
+    private:
+        Config config;
+};
+
+#endif //PNG2BR_BATCH_H
\ No newline at end of file
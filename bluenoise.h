@@ -0,0 +1,49 @@
+#ifndef PNG2BR_BLUENOISE_H
+#define PNG2BR_BLUENOISE_H
+
+#include <cstdint>
+
+/*
+ * 32x32 blue noise threshold tile, generated offline with Ulichney's
+ * void-and-cluster method (toroidal Gaussian filter, sigma 1.5). Each
+ * entry is the rank of the pixel divided by four, so every level from
+ * 0 to 255 appears exactly four times.
+ */
+constexpr uint32_t BLUE_NOISE_SIZE = 32;
+
+constexpr unsigned char blueNoiseLevels[BLUE_NOISE_SIZE * BLUE_NOISE_SIZE] = {
+    149, 220,   5, 137,  88, 167, 217, 185,  40,  65, 199, 173,  89,  70, 216,  13, 158, 110,   1, 216,  83, 231,  54,  29, 226,  85,  13, 106, 144,   3, 177,  51,
+     25, 190, 103,  43, 227,  21,  70, 125, 161, 247, 110,  16, 227, 194, 149,  95, 240,  73, 179, 133,  41, 187, 121, 174,  67, 150, 196,  62, 218, 242,  74, 117,
+    250,  61, 170, 119, 194, 145, 101, 229,   1,  84, 142,  45, 132,  57,  27, 128,  45, 209,  28,  98, 238, 151,   7, 251, 131,  43, 236, 113,  32,  91, 155, 208,
+    136,  82, 235,  11,  59, 241,  35, 203,  56, 191, 235, 178, 102, 249, 165, 222, 183, 117, 163,  58, 200,  72, 111,  89, 213,  20, 164, 139, 203, 172,  17,  44,
+    182,  21, 203, 128, 163,  79, 175, 134,  95, 155,  19,  74, 206,  12,  90,  67,   6,  81, 250, 142,  14, 220,  34, 182,  58, 193,  96,   6,  53, 126, 232, 105,
+    225, 150,  97,  49, 219, 109,   8, 253,  30, 114, 215,  40, 123, 153, 191, 236, 139, 219,  25, 194, 125, 166, 245, 154, 123, 239,  71, 210, 252,  80, 191,  63,
+    121,  35, 178, 248,  24, 148, 213,  68, 185, 232,  82, 171, 244,  59,  30, 100,  44, 161, 108,  39,  93,  76,  52,   9, 103,  27, 145, 179, 108,  36, 160,   1,
+     92, 210,  71, 133,  88, 196,  41, 125, 158,  50, 136,   4, 107, 145, 212, 174, 121, 208,  63, 177, 232, 209, 143, 195, 228, 169,  45, 130,  15, 220, 140, 243,
+     50, 166,   8, 227,  59, 170, 104, 239,  11,  99, 205, 184, 225,  80,  16, 255,  77,   0, 241, 131,  16, 115,  30,  91,  62, 211,  85, 241, 195,  94,  70, 199,
+    130, 233, 116, 190, 141,  15, 204,  81, 173, 228,  27,  69,  42, 165, 134,  55, 186, 146,  85, 196,  51, 159, 237, 175, 127,   2, 157,  60, 120,  41, 180,  20,
+    158,  80,  31,  98,  46, 245, 150,  33,  56, 114, 153, 126, 243,  97, 206, 115,  21, 224,  35, 169, 104, 218,  78,  42, 254, 107, 190,  28, 223, 143, 247, 102,
+     46, 195, 255, 165, 212,  73, 118, 219, 186, 252,  83, 213,   7, 189,  32, 238, 163,  93, 125, 251,  68,   8, 150, 197,  23, 138, 230,  96, 161,   6,  63, 212,
+     14, 141,  65,   2, 128, 184,  24,  96, 135,  15,  39, 163,  60, 147,  89,  66, 215,  47, 202,  24, 136, 188, 119,  94, 214,  71,  48, 177,  79, 204, 114, 172,
+    237, 107, 221, 155,  92,  53, 229, 168,  69, 208, 110, 195, 231, 123, 181,  10, 112, 154,  79, 172, 221,  36, 243,  53, 171, 152,  12, 249, 128,  36, 225,  87,
+    133,  49, 180,  32, 240, 204,  10, 149,  48, 234, 141,  94,  24,  47, 244, 140, 191, 234,   3, 103,  55, 159,  86,   5, 124, 237, 109, 198,  58, 184, 149,  28,
+    166,  85, 200, 118,  75, 130, 105, 250,  88, 176,   2,  64, 171, 215,  78, 100,  36,  61, 132, 248, 200, 116, 226, 181, 202,  32,  76, 143,  23,  99, 243,  67,
+    216,  22, 246,   7, 151, 193,  38, 183,  26, 122, 201, 247, 114, 148,  16, 202, 162, 220,  88, 179,  26,  70,  19, 138,  55,  98, 221, 168, 232, 124,   0, 189,
+     46, 144, 102, 173,  56, 225,  68, 144, 215,  77, 158,  40,  84, 186,  57, 254, 112,  18, 147,  43, 122, 155, 246, 106, 214, 154,   9,  48,  80, 203, 157,  92,
+    115, 229,  73, 211,  26,  99, 238,  13, 108,  55, 223, 135,   9, 234, 124,  33, 176,  69, 194, 239, 217,  86, 170,  38,  79, 187, 251, 117, 181,  34,  61, 253,
+      9, 167,  37, 120, 188, 162, 127, 198, 168, 240,  29, 176, 104, 200, 153,  90, 230, 136, 101,  14,  60, 188,   4, 228, 132,  20,  66, 139, 226, 104, 210, 133,
+     66, 197, 148, 248,  86,   2,  51,  82,  19, 123,  90, 210,  52,  23,  65, 214,   0,  50, 205, 160, 113, 140,  49, 199, 111, 164, 207,  91,   5, 151,  26, 178,
+    224,  97,  23,  57, 228, 134, 214, 255, 147, 192,  66, 156, 248, 138, 183, 111, 168, 246,  86,  30, 211, 253, 100,  74, 242,  56,  35, 233, 171,  54, 240,  84,
+     44, 129, 206, 110, 156,  31, 179,  62, 107,  39, 230,   4, 116,  81, 227,  38,  75, 120, 144, 176,  71,  17, 181, 153,  25, 192, 147, 118,  78, 190, 112, 142,
+    182, 242,  13, 174,  72, 199,  95,  22, 169, 205, 131, 180,  46, 197,  20, 159, 201,  12, 223,  47, 234, 119,  40, 218, 129,  98, 213,  14, 249,  37, 204,   7,
+     61, 152,  81, 222,  42, 120, 236, 139, 224,  12,  75,  93, 233, 146, 101, 253, 132,  62, 189,  96, 134, 170,  87, 239,   1,  77, 173,  60, 135, 160,  94, 230,
+    118,  29, 106, 137, 249,   5, 162,  83,  54, 119, 251, 165,  17,  64, 178,  50,  91, 236,  29, 160,   6, 201,  58, 142, 184,  45, 231, 105, 218,  19,  75, 167,
+    252, 193, 211,  52, 183,  67, 208,  31, 188, 156,  37, 198, 135, 217, 121,   3, 206, 148, 115, 217,  76, 250,  28, 109, 207, 122, 154,  31, 186, 126, 207,  42,
+      0,  73, 159,  17, 101, 146, 113, 246,  92, 221,  68, 109,  25,  82, 242, 187,  39,  72, 175,  51, 106, 182, 152, 222,  69,  11, 255,  83,  52, 233,  99, 143,
+    224, 131,  90, 237, 216,  37, 175,  22, 129,   3, 145, 238, 177,  44, 156, 103, 130, 245,  10, 226, 137,  18,  89,  41, 164, 100, 196, 141, 172,  10,  65, 185,
+     54, 174,  34, 187, 127,  78, 229,  57, 164, 193,  48, 207,  95, 222,  64,  18, 209, 161,  93, 192,  43, 235, 124, 244, 189,  59, 223,  22, 116, 245, 157, 111,
+     18, 244, 117,  63,  15, 151, 197,  87, 241, 105,  77, 126,   8, 169, 137, 235,  84,  33, 122,  64, 167, 201,  74,   4, 140,  34, 127,  72, 212,  87,  33, 202,
+     97,  76, 162, 205, 254,  49, 112,  11, 138, 219,  27, 152, 252,  38, 113, 185,  53, 198, 254, 146,  21, 108, 157, 209, 102, 180, 247, 166,  47, 192, 129, 231
+};
+
+#endif //PNG2BR_BLUENOISE_H
\ No newline at end of file
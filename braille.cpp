@@ -0,0 +1,230 @@
+#include "braille.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BRAILLE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    // Dot bits of the left and right pixel for each of the four pixel rows of a cell
+    constexpr unsigned char dotLeft[BrailleEncoder::CELL_HEIGHT] = { 0x01, 0x02, 0x04, 0x40 };
+    constexpr unsigned char dotRight[BrailleEncoder::CELL_HEIGHT] = { 0x08, 0x10, 0x20, 0x80 };
+
+    unsigned char encodeCell(const unsigned char* const* rows, uint32_t x, uint32_t width)
+    {
+        unsigned char cell = 0;
+
+        for (uint32_t r = 0; r < BrailleEncoder::CELL_HEIGHT; r++)
+        {
+            if (!rows[r])
+                continue;
+
+            cell |= (rows[r][x] != 0) * dotLeft[r];
+
+            if (x + 1 < width)
+                cell |= (rows[r][x + 1] != 0) * dotRight[r];
+        }
+
+        return cell;
+    }
+
+    // For each pixel row of a cell, the dots that a byte of 8 packed pixels raises in its 4 cells, one byte per cell
+    constexpr auto rowDots = [] {
+        std::array<std::array<uint32_t, 256>, BrailleEncoder::CELL_HEIGHT> table{};
+
+        for (uint32_t r = 0; r < BrailleEncoder::CELL_HEIGHT; r++)
+        {
+            for (uint32_t bits = 0; bits < 256; bits++)
+            {
+                for (uint32_t c = 0; c < 4; c++)
+                {
+                    if (bits >> (2 * c) & 1)
+                        table[r][bits] |= static_cast<uint32_t>(dotLeft[r]) << (8 * c);
+
+                    if (bits >> (2 * c + 1) & 1)
+                        table[r][bits] |= static_cast<uint32_t>(dotRight[r]) << (8 * c);
+                }
+            }
+        }
+
+        return table;
+    }();
+
+#if BRAILLE_SSE2
+    // 8 cells from 16 pixels of each row, as the low bytes of eight 16-bit lanes
+    inline __m128i encode8(const unsigned char* const* rows, uint32_t x)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        __m128i bits = zero;
+
+        for (uint32_t r = 0; r < BrailleEncoder::CELL_HEIGHT; r++)
+        {
+            if (!rows[r])
+                continue;
+
+            // Each 16-bit lane holds the left pixel in the low and the right one in the high byte
+            __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[r] + x));
+            __m128i set = _mm_andnot_si128(_mm_cmpeq_epi8(px, zero), _mm_set1_epi8(-1));
+            bits = _mm_or_si128(bits, _mm_and_si128(set, _mm_set1_epi16(static_cast<short>(dotRight[r] << 8 | dotLeft[r]))));
+        }
+
+        return _mm_or_si128(_mm_and_si128(bits, _mm_set1_epi16(0x00FF)), _mm_srli_epi16(bits, 8));
+    }
+#endif
+}
+
+BrailleEncoder::BrailleEncoder(bool blankAsDot) : table()
+{
+    for (uint32_t i = 0; i < GImage::levels; i++)
+    {
+        uint32_t pattern = i;
+
+        if (blankAsDot && pattern == 0)
+            pattern = 0x01u;
+
+        pattern |= 0x2800u;
+
+        // Some UTF-8 magic
+        this->table[i][0] = static_cast<char>((pattern >> 12u) + 0xE0u);
+        this->table[i][1] = static_cast<char>(((pattern >> 6u) & 0x3Fu) + 0x80u);
+        this->table[i][2] = static_cast<char>((pattern & 0x3Fu) + 0x80u);
+    }
+}
+
+uint32_t BrailleEncoder::cellsPerRow(uint32_t width)
+{
+    return (width + CELL_WIDTH - 1) / CELL_WIDTH;
+}
+
+uint32_t BrailleEncoder::cellRows(uint32_t height)
+{
+    return (height + CELL_HEIGHT - 1) / CELL_HEIGHT;
+}
+
+void BrailleEncoder::encodeCells(const GConstImageView& img, uint32_t y, unsigned char* cells)
+{
+    const unsigned char* rows[CELL_HEIGHT];
+
+    for (uint32_t r = 0; r < CELL_HEIGHT; r++)
+        rows[r] = y + r < img.height ? img.row(y + r) : nullptr;
+
+    const uint32_t count = cellsPerRow(img.width);
+    uint32_t c = 0;
+
+#if BRAILLE_SSE2
+    for (; (c + 16) * CELL_WIDTH <= img.width; c += 16)
+    {
+        __m128i lo = encode8(rows, c * CELL_WIDTH);
+        __m128i hi = encode8(rows, (c + 8) * CELL_WIDTH);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(cells + c), _mm_packus_epi16(lo, hi));
+    }
+#endif
+
+    for (; c < count; c++)
+        cells[c] = encodeCell(rows, c * CELL_WIDTH, img.width);
+}
+
+void BrailleEncoder::encodeImage(const GConstImageView& img, unsigned char* cells)
+{
+    const uint32_t columns = cellsPerRow(img.width);
+    const uint32_t rows = cellRows(img.height);
+
+    for (uint32_t r = 0; r < rows; r++)
+        encodeCells(img, r * CELL_HEIGHT, cells + static_cast<std::size_t>(r) * columns);
+}
+
+void BrailleEncoder::encodeCells(const GBitImage& img, uint32_t y, unsigned char* cells)
+{
+    thread_local std::vector<uint64_t> blank;
+    const uint64_t* rows[CELL_HEIGHT];
+
+    // Rows below the image read as a blank row
+    if (y + CELL_HEIGHT > img.getHeight())
+        blank.assign(img.getWordsPerRow(), 0);
+
+    for (uint32_t r = 0; r < CELL_HEIGHT; r++)
+        rows[r] = y + r < img.getHeight() ? img.row(y + r) : blank.data();
+
+    const uint32_t count = cellsPerRow(img.getWidth());
+
+    // Each word covers 64 pixels and so 32 cells, bits past the width are clear
+    for (std::size_t word = 0; word < img.getWordsPerRow(); word++)
+    {
+        const uint64_t w0 = rows[0][word];
+        const uint64_t w1 = rows[1][word];
+        const uint64_t w2 = rows[2][word];
+        const uint64_t w3 = rows[3][word];
+        const std::size_t first = word * 32;
+        unsigned char block[32];
+
+        for (uint32_t b = 0; b < 8; b++)
+        {
+            const uint32_t shift = 8 * b;
+            const uint32_t four = rowDots[0][(w0 >> shift) & 0xFF] | rowDots[1][(w1 >> shift) & 0xFF]
+                                  | rowDots[2][(w2 >> shift) & 0xFF] | rowDots[3][(w3 >> shift) & 0xFF];
+
+            for (uint32_t c = 0; c < 4; c++)
+                block[b * 4 + c] = static_cast<unsigned char>(four >> (8 * c));
+        }
+
+        if (first + sizeof(block) <= count)
+            std::memcpy(cells + first, block, sizeof(block));
+        else
+            std::memcpy(cells + first, block, count - first);
+    }
+}
+
+void BrailleEncoder::encodeImage(const GBitImage& img, unsigned char* cells)
+{
+    const uint32_t columns = cellsPerRow(img.getWidth());
+    const uint32_t rows = cellRows(img.getHeight());
+
+    for (uint32_t r = 0; r < rows; r++)
+        encodeCells(img, r * CELL_HEIGHT, cells + static_cast<std::size_t>(r) * columns);
+}
+
+const char* BrailleEncoder::glyph(unsigned char cell) const
+{
+    return this->table[cell].data();
+}
+
+std::size_t BrailleEncoder::writeGlyphs(const unsigned char* cells, uint32_t count, char* out) const
+{
+    for (uint32_t c = 0; c < count; c++)
+        std::memcpy(out + c * GLYPH_BYTES, this->table[cells[c]].data(), GLYPH_BYTES);
+
+    return static_cast<std::size_t>(count) * GLYPH_BYTES;
+}
+
+std::size_t BrailleEncoder::encodeRow(const GConstImageView& img, uint32_t y, char* out) const
+{
+    thread_local std::vector<unsigned char> cells;
+
+    const uint32_t count = cellsPerRow(img.width);
+    cells.resize(count);
+
+    encodeCells(img, y, cells.data());
+
+    return this->writeGlyphs(cells.data(), count, out);
+}
+
+void BrailleEncoder::encode(const GConstImageView& img, std::string& out) const
+{
+    const std::size_t rowBytes = static_cast<std::size_t>(cellsPerRow(img.width)) * GLYPH_BYTES + 1;
+    const uint32_t rows = cellRows(img.height);
+
+    out.resize(rowBytes * rows);
+    char* ptr = out.data();
+
+    for (uint32_t row = 0; row < rows; row++)
+    {
+        ptr += this->encodeRow(img, row * CELL_HEIGHT, ptr);
+        *ptr++ = '\n';
+    }
+}
\ No newline at end of file
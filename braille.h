@@ -0,0 +1,53 @@
+#ifndef PNG2BR_BRAILLE_H
+#define PNG2BR_BRAILLE_H
+
+#include "image.h"
+
+#include <array>
+#include <cstddef>
+#include <string>
+
+/*
+ * Converts 2x4 pixel blocks into Unicode braille glyphs (U+2800 - U+28FF).
+ *
+ * A cell is a byte with one bit per dot in Unicode order, a pixel counts as
+ * a raised dot when it is non-zero. Cells are packed 16 at a time with SSE2
+ * where available and mapped to UTF-8 through a 256-entry table.
+ *
+ * A GBitImage is encoded 4 cells at a time: each byte of packed pixels is
+ * looked up in a 4 KB table holding the dots it raises in its 4 cells for
+ * its pixel row, and the results of the 4 rows are ORed together.
+ */
+class BrailleEncoder
+{
+    public:
+        static constexpr uint32_t CELL_WIDTH = 2;
+        static constexpr uint32_t CELL_HEIGHT = 4;
+        static constexpr uint32_t GLYPH_BYTES = 3;
+
+        // blankAsDot renders empty cells as a single dot, for fonts that collapse U+2800
+        explicit BrailleEncoder(bool blankAsDot = false);
+
+        [[nodiscard]] static uint32_t cellsPerRow(uint32_t width);
+        [[nodiscard]] static uint32_t cellRows(uint32_t height);
+
+        // Packs the row of cells whose top pixel row is y, pixels outside the image count as blank
+        static void encodeCells(const GConstImageView& img, uint32_t y, unsigned char* cells);
+        // Packs all rows of cells, cells needs cellsPerRow(width) * cellRows(height) bytes
+        static void encodeImage(const GConstImageView& img, unsigned char* cells);
+        static void encodeCells(const GBitImage& img, uint32_t y, unsigned char* cells);
+        static void encodeImage(const GBitImage& img, unsigned char* cells);
+
+        [[nodiscard]] const char* glyph(unsigned char cell) const;
+        // Writes count glyphs to out, returns the number of bytes written
+        std::size_t writeGlyphs(const unsigned char* cells, uint32_t count, char* out) const;
+        // Encodes the row of cells whose top pixel row is y, out needs cellsPerRow(width) * GLYPH_BYTES bytes
+        std::size_t encodeRow(const GConstImageView& img, uint32_t y, char* out) const;
+        // Encodes the whole image into out, one line per row of cells
+        void encode(const GConstImageView& img, std::string& out) const;
+
+    private:
+        std::array<std::array<char, GLYPH_BYTES>, GImage::levels> table;
+};
+
+#endif //PNG2BR_BRAILLE_H
\ No newline at end of file
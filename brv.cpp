@@ -0,0 +1,417 @@
+#include "brv.h"
+#include "util.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <iterator>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    // Zero runs shorter than this stay part of the literal, a new run would cost as much
+    constexpr std::size_t MIN_ZERO_RUN = 3;
+
+    void putVarint(std::vector<unsigned char>& out, std::size_t value)
+    {
+        while (value >= 0x80)
+        {
+            out.push_back(static_cast<unsigned char>(value | 0x80));
+            value >>= 7;
+        }
+
+        out.push_back(static_cast<unsigned char>(value));
+    }
+
+    std::size_t getVarint(const unsigned char*& in, const unsigned char* end)
+    {
+        std::size_t value = 0;
+
+        for (uint32_t shift = 0; shift < 64; shift += 7)
+        {
+            if (in == end)
+                break;
+
+            const unsigned char byte = *in++;
+            value |= static_cast<std::size_t>(byte & 0x7F) << shift;
+
+            if (!(byte & 0x80))
+                return value;
+        }
+
+        throw std::runtime_error("Corrupt frame in braille video");
+    }
+
+    int64_t toMicroseconds(double seconds)
+    {
+        return static_cast<int64_t>(std::llround(seconds * 1000000.0));
+    }
+}
+
+BrvWriter::BrvWriter(const std::filesystem::path& path, uint32_t columnsIn, uint32_t rowsIn, uint32_t keyframeIntervalIn)
+    : out(path, std::ios::binary | std::ios::trunc), columns(columnsIn), rows(rowsIn), keyframeInterval(keyframeIntervalIn),
+      previous(static_cast<std::size_t>(columnsIn) * rowsIn)
+{
+    if (!this->out)
+        throw std::runtime_error("Could not create " + path.string());
+
+    // Completed by finish()
+    unsigned char header[HEADER_SIZE] = {};
+    this->writeBytes(header, sizeof(header));
+}
+
+BrvWriter::~BrvWriter()
+{
+    try
+    {
+        this->finish();
+    }
+    catch (...)
+    {
+
+    }
+}
+
+void BrvWriter::write(const unsigned char* cells, double timestamp, bool keyframe)
+{
+    if (this->finished)
+        throw std::logic_error("The braille video is already finished");
+
+    keyframe = keyframe || this->frames == 0 || (this->keyframeInterval && this->sinceKeyframe >= this->keyframeInterval);
+
+    const std::size_t count = this->previous.size();
+    std::size_t i = 0;
+
+    this->payload.clear();
+
+    // Deltas are encoded as the XOR with the previous frame, keyframes as they are
+    auto value = [&] (std::size_t at) -> unsigned char {
+        return keyframe ? cells[at] : static_cast<unsigned char>(cells[at] ^ this->previous[at]);
+    };
+
+    while (i < count)
+    {
+        std::size_t zeros = 0;
+
+        while (i + zeros < count && !value(i + zeros))
+            zeros++;
+
+        i += zeros;
+
+        // The literal ends where a zero run long enough to be worth its own entry starts
+        std::size_t literal = 0;
+        std::size_t run = 0;
+
+        while (i + literal + run < count && run < MIN_ZERO_RUN)
+        {
+            if (value(i + literal + run))
+            {
+                literal += run + 1;
+                run = 0;
+            }
+            else
+                run++;
+        }
+
+        putVarint(this->payload, zeros);
+        putVarint(this->payload, literal);
+
+        for (std::size_t k = 0; k < literal; k++)
+            this->payload.push_back(value(i + k));
+
+        i += literal;
+    }
+
+    if (keyframe)
+    {
+        this->index.push_back({ toMicroseconds(timestamp), this->offset, this->frames });
+        this->sinceKeyframe = 0;
+    }
+
+    unsigned char header[RECORD_HEADER_SIZE];
+    store_le(header, toMicroseconds(timestamp));
+    store_le(header + 8, keyframe ? FLAG_KEYFRAME : 0u);
+    store_le(header + 12, static_cast<uint32_t>(this->payload.size()));
+
+    this->writeBytes(header, sizeof(header));
+    this->writeBytes(this->payload.data(), this->payload.size());
+
+    std::copy_n(cells, count, this->previous.data());
+    this->frames++;
+    this->sinceKeyframe++;
+}
+
+void BrvWriter::finish()
+{
+    if (this->finished)
+        return;
+
+    this->finished = true;
+
+    const uint64_t indexOffset = this->offset;
+
+    for (const IndexEntry& entry : this->index)
+    {
+        unsigned char bytes[INDEX_ENTRY_SIZE];
+        store_le(bytes, entry.pts);
+        store_le(bytes + 8, entry.offset);
+        store_le(bytes + 16, entry.frame);
+        this->writeBytes(bytes, sizeof(bytes));
+    }
+
+    unsigned char header[HEADER_SIZE] = {};
+    std::memcpy(header, MAGIC, sizeof(MAGIC));
+    store_le(header + 8, this->columns);
+    store_le(header + 12, this->rows);
+    store_le(header + 16, this->frames);
+    store_le(header + 24, indexOffset);
+    store_le(header + 32, static_cast<uint64_t>(this->index.size()));
+    store_le(header + 40, this->keyframeInterval);
+
+    this->out.seekp(0);
+    this->out.write(reinterpret_cast<const char*>(header), sizeof(header));
+    this->out.close();
+
+    if (!this->out)
+        throw std::runtime_error("Could not write braille video");
+}
+
+uint64_t BrvWriter::getFrameCount() const
+{
+    return this->frames;
+}
+
+uint64_t BrvWriter::getKeyframeCount() const
+{
+    return this->index.size();
+}
+
+uint64_t BrvWriter::getBytes() const
+{
+    return this->offset;
+}
+
+void BrvWriter::writeBytes(const void* bytes, std::size_t count)
+{
+    this->out.write(static_cast<const char*>(bytes), static_cast<std::streamsize>(count));
+
+    if (!this->out)
+        throw std::runtime_error("Could not write braille video");
+
+    this->offset += count;
+}
+
+BrvReader::BrvReader(const std::filesystem::path& path)
+{
+#ifdef _WIN32
+    std::ifstream in(path, std::ios::binary);
+
+    if (!in)
+        throw std::runtime_error("Could not open " + path.string());
+
+    this->contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    this->data = this->contents.data();
+    this->size = this->contents.size();
+#else
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+        throw std::runtime_error("Could not open " + path.string());
+
+    struct stat info{};
+
+    if (::fstat(fd, &info) < 0 || info.st_size < static_cast<off_t>(BrvWriter::HEADER_SIZE))
+    {
+        ::close(fd);
+        throw std::runtime_error("Not a braille video: " + path.string());
+    }
+
+    this->size = static_cast<std::size_t>(info.st_size);
+    void* mapping = ::mmap(nullptr, this->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if (mapping == MAP_FAILED)
+        throw std::runtime_error("Could not map " + path.string());
+
+    // Played front to back, the kernel may read ahead aggressively
+    ::madvise(mapping, this->size, MADV_SEQUENTIAL);
+    this->data = static_cast<const unsigned char*>(mapping);
+#endif
+
+    try
+    {
+        if (this->size < BrvWriter::HEADER_SIZE || std::memcmp(this->data, BrvWriter::MAGIC, sizeof(BrvWriter::MAGIC)) != 0)
+            throw std::runtime_error("Not a braille video: " + path.string());
+
+        this->columns = load_le<uint32_t>(this->data + 8);
+        this->rows = load_le<uint32_t>(this->data + 12);
+        this->frameCount = load_le<uint64_t>(this->data + 16);
+        const auto indexOffset = load_le<uint64_t>(this->data + 24);
+        this->keyframeCount = load_le<uint64_t>(this->data + 32);
+
+        if (indexOffset < BrvWriter::HEADER_SIZE || indexOffset > this->size
+            || this->keyframeCount > (this->size - indexOffset) / BrvWriter::INDEX_ENTRY_SIZE
+            || (this->frameCount && !this->keyframeCount))
+            throw std::runtime_error("Incomplete or corrupt braille video: " + path.string());
+
+        this->index = this->data + indexOffset;
+        this->framesEnd = indexOffset;
+        this->cells.resize(static_cast<std::size_t>(this->columns) * this->rows);
+
+        // The duration is the PTS of the last frame, which comes at most a keyframe interval after the last keyframe
+        if (this->keyframeCount)
+        {
+            std::size_t at = load_le<uint64_t>(this->index + (this->keyframeCount - 1) * BrvWriter::INDEX_ENTRY_SIZE + 8);
+
+            while (at + BrvWriter::RECORD_HEADER_SIZE <= this->framesEnd)
+            {
+                this->duration = static_cast<double>(load_le<int64_t>(this->data + at)) / 1000000.0;
+                at += BrvWriter::RECORD_HEADER_SIZE + load_le<uint32_t>(this->data + at + 12);
+            }
+        }
+
+        this->position = BrvWriter::HEADER_SIZE;
+    }
+    catch (...)
+    {
+#ifndef _WIN32
+        ::munmap(const_cast<unsigned char*>(this->data), this->size);
+#endif
+        throw;
+    }
+}
+
+BrvReader::~BrvReader()
+{
+#ifndef _WIN32
+    ::munmap(const_cast<unsigned char*>(this->data), this->size);
+#endif
+}
+
+const unsigned char* BrvReader::next()
+{
+    if (this->nextFrame >= this->frameCount || this->position + BrvWriter::RECORD_HEADER_SIZE > this->framesEnd)
+        return nullptr;
+
+    const unsigned char* record = this->data + this->position;
+    const auto payloadSize = load_le<uint32_t>(record + 12);
+
+    if (payloadSize > this->framesEnd - this->position - BrvWriter::RECORD_HEADER_SIZE)
+        throw std::runtime_error("Corrupt frame in braille video");
+
+    this->timestamp = static_cast<double>(load_le<int64_t>(record)) / 1000000.0;
+    this->keyframe = load_le<uint32_t>(record + 8) & BrvWriter::FLAG_KEYFRAME;
+    this->decode(record + BrvWriter::RECORD_HEADER_SIZE, payloadSize, this->keyframe);
+
+    this->position += BrvWriter::RECORD_HEADER_SIZE + payloadSize;
+    this->nextFrame++;
+
+    return this->cells.data();
+}
+
+void BrvReader::seek(double target)
+{
+    const int64_t pts = toMicroseconds(target);
+
+    // Keyframes are stored in PTS order, the entry before the first one later than the target
+    uint64_t lo = 0;
+    uint64_t hi = this->keyframeCount;
+
+    while (lo < hi)
+    {
+        const uint64_t mid = lo + (hi - lo) / 2;
+
+        if (load_le<int64_t>(this->index + mid * BrvWriter::INDEX_ENTRY_SIZE) <= pts)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    const uint64_t entry = lo ? lo - 1 : 0;
+
+    if (entry >= this->keyframeCount)
+        return;
+
+    const unsigned char* at = this->index + entry * BrvWriter::INDEX_ENTRY_SIZE;
+    this->position = load_le<uint64_t>(at + 8);
+    this->nextFrame = load_le<uint64_t>(at + 16);
+}
+
+double BrvReader::getTimestamp() const
+{
+    return this->timestamp;
+}
+
+bool BrvReader::isKeyframe() const
+{
+    return this->keyframe;
+}
+
+uint64_t BrvReader::getFrameNumber() const
+{
+    return this->nextFrame ? this->nextFrame - 1 : 0;
+}
+
+uint32_t BrvReader::getColumns() const
+{
+    return this->columns;
+}
+
+uint32_t BrvReader::getRows() const
+{
+    return this->rows;
+}
+
+uint64_t BrvReader::getFrameCount() const
+{
+    return this->frameCount;
+}
+
+uint64_t BrvReader::getKeyframeCount() const
+{
+    return this->keyframeCount;
+}
+
+double BrvReader::getDuration() const
+{
+    return this->duration;
+}
+
+void BrvReader::decode(const unsigned char* payload, std::size_t payloadSize, bool isKey)
+{
+    const unsigned char* in = payload;
+    const unsigned char* end = payload + payloadSize;
+    const std::size_t count = this->cells.size();
+    std::size_t i = 0;
+
+    if (isKey)
+        std::fill(this->cells.begin(), this->cells.end(), 0);
+
+    while (in < end)
+    {
+        const std::size_t zeros = getVarint(in, end);
+        const std::size_t literal = getVarint(in, end);
+
+        if (zeros > count - i)
+            throw std::runtime_error("Corrupt frame in braille video");
+
+        i += zeros;
+
+        if (literal > count - i || literal > static_cast<std::size_t>(end - in))
+            throw std::runtime_error("Corrupt frame in braille video");
+
+        for (std::size_t k = 0; k < literal; k++)
+            this->cells[i + k] ^= in[k];
+
+        in += literal;
+        i += literal;
+    }
+}
\ No newline at end of file
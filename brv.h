@@ -0,0 +1,133 @@
+#ifndef PNG2BR_BRV_H
+#define PNG2BR_BRV_H
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+/*
+ * Pre-rendered braille video. A .brv file holds the braille cells (one byte
+ * of 2x4 dots each, see BrailleEncoder) of every frame, so playing it back
+ * only takes rendering the cells to the terminal:
+ *
+ *     header   "PNG2BRV1", uint32 columns, uint32 rows, uint64 frame count,
+ *              uint64 index offset, uint64 keyframe count,
+ *              uint32 keyframe interval, uint32 reserved
+ *     frames   int64 PTS in microseconds, uint32 flags (1: keyframe),
+ *              uint32 payload size, payload
+ *     index    per keyframe: int64 PTS in microseconds, uint64 offset of
+ *              its record, uint64 frame number
+ *
+ * Numbers are little endian. A keyframe payload encodes the cells, a delta
+ * frame payload the cells XORed with the previous frame's, both as runs of
+ * varint zero count, varint literal count and the literal bytes. Static
+ * parts of a frame cost next to nothing that way, and so do blank areas of
+ * keyframes. The header is completed by finish(), a file that was not
+ * finished has no index and is rejected.
+ */
+class BrvWriter
+{
+    public:
+        static constexpr char MAGIC[8] = { 'P', 'N', 'G', '2', 'B', 'R', 'V', '1' };
+        static constexpr std::size_t HEADER_SIZE = 48;
+        static constexpr std::size_t RECORD_HEADER_SIZE = 16;
+        static constexpr std::size_t INDEX_ENTRY_SIZE = 24;
+        static constexpr uint32_t FLAG_KEYFRAME = 1;
+
+        // A keyframe is forced every keyframeInterval frames, 0 only makes the first frame one
+        BrvWriter(const std::filesystem::path& path, uint32_t columnsIn, uint32_t rowsIn, uint32_t keyframeIntervalIn = 60);
+        // Finishes the file, errors are ignored
+        ~BrvWriter();
+
+        // cells holds columns * rows cells, keyframe forces a keyframe (e.g. on a scene cut)
+        void write(const unsigned char* cells, double timestamp, bool keyframe = false);
+        // Writes the index and completes the header
+        void finish();
+
+        [[nodiscard]] uint64_t getFrameCount() const;
+        [[nodiscard]] uint64_t getKeyframeCount() const;
+        [[nodiscard]] uint64_t getBytes() const;
+
+    private:
+        struct IndexEntry
+        {
+            int64_t pts;
+            uint64_t offset;
+            uint64_t frame;
+        };
+
+        void writeBytes(const void* data, std::size_t size);
+
+        std::ofstream out;
+        uint32_t columns;
+        uint32_t rows;
+        uint32_t keyframeInterval;
+
+        std::vector<unsigned char> previous;
+        std::vector<unsigned char> payload;
+        std::vector<IndexEntry> index;
+        uint64_t frames = 0;
+        uint64_t offset = 0;
+        uint32_t sinceKeyframe = 0;
+        bool finished = false;
+};
+
+/*
+ * Plays a .brv file from a read-only memory mapping, frames are decoded
+ * in place from the mapped pages.
+ */
+class BrvReader
+{
+    public:
+        explicit BrvReader(const std::filesystem::path& path);
+
+        BrvReader(const BrvReader&) = delete;
+        BrvReader& operator=(const BrvReader&) = delete;
+
+        ~BrvReader();
+
+        // The cells of the next frame, nullptr after the last one
+        const unsigned char* next();
+        // Continues with the last keyframe at or before the timestamp, the first one if there is none
+        void seek(double timestamp);
+
+        // Of the frame returned by next()
+        [[nodiscard]] double getTimestamp() const;
+        [[nodiscard]] bool isKeyframe() const;
+        [[nodiscard]] uint64_t getFrameNumber() const;
+
+        [[nodiscard]] uint32_t getColumns() const;
+        [[nodiscard]] uint32_t getRows() const;
+        [[nodiscard]] uint64_t getFrameCount() const;
+        [[nodiscard]] uint64_t getKeyframeCount() const;
+        // Of the last frame
+        [[nodiscard]] double getDuration() const;
+
+    private:
+        void decode(const unsigned char* data, std::size_t size, bool keyframe);
+
+        const unsigned char* data = nullptr;
+        std::size_t size = 0;
+#ifdef _WIN32
+        std::vector<unsigned char> contents;
+#endif
+
+        uint32_t columns = 0;
+        uint32_t rows = 0;
+        uint64_t frameCount = 0;
+        uint64_t keyframeCount = 0;
+        const unsigned char* index = nullptr;
+        // End of the frame records
+        std::size_t framesEnd = 0;
+
+        std::vector<unsigned char> cells;
+        std::size_t position = 0;
+        uint64_t nextFrame = 0;
+        double timestamp = 0;
+        bool keyframe = false;
+        double duration = 0;
+};
+
+#endif //PNG2BR_BRV_H
\ No newline at end of file
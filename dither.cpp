@@ -0,0 +1,373 @@
+#include "dither.h"
+#include "bluenoise.h"
+
+#include <algorithm>
+#include <array>
+#include <climits>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DITHER_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    struct Tap
+    {
+        int dx;
+        int dy;
+        int weight;
+    };
+
+    template<DiffusionKernel K>
+    struct KernelTaps;
+
+    template<>
+    struct KernelTaps<DiffusionKernel::FloydSteinberg>
+    {
+        static constexpr int divisor = 16;
+        static constexpr std::array<Tap, 4> taps{{
+            { 1, 0, 7 },
+            { -1, 1, 3 }, { 0, 1, 5 }, { 1, 1, 1 }
+        }};
+    };
+
+    // Only diffuses 6/8 of the error, which keeps highlights and shadows clean
+    template<>
+    struct KernelTaps<DiffusionKernel::Atkinson>
+    {
+        static constexpr int divisor = 8;
+        static constexpr std::array<Tap, 6> taps{{
+            { 1, 0, 1 }, { 2, 0, 1 },
+            { -1, 1, 1 }, { 0, 1, 1 }, { 1, 1, 1 },
+            { 0, 2, 1 }
+        }};
+    };
+
+    template<>
+    struct KernelTaps<DiffusionKernel::SierraLite>
+    {
+        static constexpr int divisor = 4;
+        static constexpr std::array<Tap, 3> taps{{
+            { 1, 0, 2 },
+            { -1, 1, 1 }, { 0, 1, 1 }
+        }};
+    };
+
+    template<>
+    struct KernelTaps<DiffusionKernel::Stucki>
+    {
+        static constexpr int divisor = 42;
+        static constexpr std::array<Tap, 12> taps{{
+            { 1, 0, 8 }, { 2, 0, 4 },
+            { -2, 1, 2 }, { -1, 1, 4 }, { 0, 1, 8 }, { 1, 1, 4 }, { 2, 1, 2 },
+            { -2, 2, 1 }, { -1, 2, 2 }, { 0, 2, 4 }, { 1, 2, 2 }, { 2, 2, 1 }
+        }};
+    };
+
+    template<typename Kernel, std::size_t N, int dir>
+    inline void spread_tap(int error, int* ahead, int16_t* const* rows, int x)
+    {
+        constexpr Tap tap = Kernel::taps[N];
+        int part = error * tap.weight / Kernel::divisor;
+
+        if constexpr (tap.dy == 0)
+            ahead[tap.dx - 1] += part;
+        else
+            rows[tap.dy][x + tap.dx * dir] += static_cast<int16_t>(part);
+    }
+
+    // Unrolled at compile time, so the taps become constants
+    template<typename Kernel, int dir, std::size_t... N>
+    inline void spread_error(int error, int* ahead, int16_t* const* rows, int x, std::index_sequence<N...>)
+    {
+        (spread_tap<Kernel, N, dir>(error, ahead, rows, x), ...);
+    }
+
+    // rows[0] is the current row, rows[n] the one n rows below, dir is 1 or -1.
+    // Error for the current row only ever goes ahead, so it is carried in registers.
+    template<DiffusionKernel K, int dir>
+    void diffuse_row(const unsigned char* in, unsigned char* out, int16_t* const* rowsIn, int width, unsigned char threshold)
+    {
+        using Kernel = KernelTaps<K>;
+
+        // Local copies, the output bytes could otherwise alias the pointers
+        int16_t* const rows[3] = { rowsIn[0], rowsIn[1], rowsIn[2] };
+        int ahead[2] = {};
+
+        int x = dir > 0 ? 0 : width - 1;
+
+        for (int i = 0; i < width; i++, x += dir)
+        {
+            int pixel = in[x] + rows[0][x] + ahead[0];
+            unsigned char color = (threshold < pixel) * UCHAR_MAX;
+            int error = pixel - color;
+
+            ahead[0] = ahead[1];
+            ahead[1] = 0;
+
+            spread_error<Kernel, dir>(error, ahead, rows, x, std::make_index_sequence<Kernel::taps.size()>());
+
+            out[x] = color;
+        }
+    }
+
+    template<DiffusionKernel K>
+    void diffuse_row(const unsigned char* in, unsigned char* out, int16_t* const* rows, int width, unsigned char threshold, bool reverse)
+    {
+        if (reverse)
+            diffuse_row<K, -1>(in, out, rows, width, threshold);
+        else
+            diffuse_row<K, 1>(in, out, rows, width, threshold);
+    }
+
+    // Levels of a 2^bits Bayer matrix, from the recursion M(2n) = [4M(n), 4M(n) + 2; 4M(n) + 3, 4M(n) + 1].
+    // Each entry is the centre of its index's share of the 0-255 range.
+    template<uint32_t bits>
+    constexpr std::array<unsigned char, (1u << bits) * (1u << bits)> bayer_levels()
+    {
+        constexpr uint32_t size = 1u << bits;
+        std::array<unsigned char, size * size> levels{};
+
+        for (uint32_t y = 0; y < size; y++)
+        {
+            for (uint32_t x = 0; x < size; x++)
+            {
+                uint32_t index = 0;
+
+                // The lowest coordinate bits select the coarsest quadrant, i.e. the highest index bits
+                for (uint32_t i = 0; i < bits; i++)
+                {
+                    uint32_t xb = (x >> i) & 1u;
+                    uint32_t yb = (y >> i) & 1u;
+                    index |= ((xb ^ yb) << 1u | yb) << (2 * (bits - 1 - i));
+                }
+
+                levels[y * size + x] = static_cast<unsigned char>((index * 2 + 1) * 128 / (size * size));
+            }
+        }
+
+        return levels;
+    }
+
+    constexpr auto bayer4Levels = bayer_levels<2>();
+    constexpr auto bayer8Levels = bayer_levels<3>();
+    constexpr auto bayer16Levels = bayer_levels<4>();
+
+    struct Tile
+    {
+        const unsigned char* levels;
+        uint32_t size;
+    };
+
+    Tile pattern_tile(OrderedPattern pattern)
+    {
+        switch (pattern)
+        {
+            case OrderedPattern::Bayer4:
+                return { bayer4Levels.data(), 4 };
+            case OrderedPattern::Bayer8:
+                return { bayer8Levels.data(), 8 };
+            case OrderedPattern::Bayer16:
+                return { bayer16Levels.data(), 16 };
+            case OrderedPattern::BlueNoise:
+                return { blueNoiseLevels, BLUE_NOISE_SIZE };
+        }
+
+        return { bayer8Levels.data(), 8 };
+    }
+}
+
+ErrorDiffuser::ErrorDiffuser(DiffusionKernel kernelIn, bool serpentineIn) : kernel(kernelIn), serpentine(serpentineIn)
+{
+
+}
+
+void ErrorDiffuser::setKernel(DiffusionKernel kernelIn)
+{
+    this->kernel = kernelIn;
+}
+
+void ErrorDiffuser::setSerpentine(bool enabled)
+{
+    this->serpentine = enabled;
+}
+
+void ErrorDiffuser::begin(uint32_t widthIn, unsigned char thresholdIn)
+{
+    this->width = widthIn;
+    this->threshold = thresholdIn;
+    this->bias = static_cast<int16_t>(UCHAR_MAX / 2 - thresholdIn);
+    this->row = 0;
+
+    // assign() keeps the capacity, so only a wider image reallocates
+    this->errors.assign(static_cast<std::size_t>(this->width + BORDER * 2) * ROWS, this->bias);
+}
+
+void ErrorDiffuser::diffuseRow(const unsigned char* in, unsigned char* out)
+{
+    const std::size_t stride = this->width + BORDER * 2;
+    int16_t* rows[ROWS];
+
+    for (uint32_t i = 0; i < ROWS; i++)
+        rows[i] = this->errors.data() + ((this->row + i) % ROWS) * stride + BORDER;
+
+    const int w = static_cast<int>(this->width);
+    const bool reverse = this->serpentine && (this->row & 1u);
+
+    switch (this->kernel)
+    {
+        case DiffusionKernel::FloydSteinberg:
+            diffuse_row<DiffusionKernel::FloydSteinberg>(in, out, rows, w, this->threshold, reverse);
+            break;
+        case DiffusionKernel::Atkinson:
+            diffuse_row<DiffusionKernel::Atkinson>(in, out, rows, w, this->threshold, reverse);
+            break;
+        case DiffusionKernel::SierraLite:
+            diffuse_row<DiffusionKernel::SierraLite>(in, out, rows, w, this->threshold, reverse);
+            break;
+        case DiffusionKernel::Stucki:
+            diffuse_row<DiffusionKernel::Stucki>(in, out, rows, w, this->threshold, reverse);
+            break;
+    }
+
+    // The current row is recycled as the one furthest below
+    std::fill_n(rows[0] - BORDER, stride, this->bias);
+    this->row++;
+}
+
+void ErrorDiffuser::diffuse(const GConstImageView& src, const GImageView& dst, unsigned char thresholdIn)
+{
+    this->begin(src.width, thresholdIn);
+
+    for (uint32_t y = 0; y < src.height; y++)
+        this->diffuseRow(src.row(y), dst.row(y));
+}
+
+void ErrorDiffuser::diffuse(const GConstImageView& src, GBitImage& dst, unsigned char thresholdIn)
+{
+    this->begin(src.width, thresholdIn);
+    this->packRow.resize(src.width);
+    dst.realloc_size(src.width, src.height);
+
+    // The error diffusion works on bytes, each row is packed while it is still in cache
+    for (uint32_t y = 0; y < src.height; y++)
+    {
+        this->diffuseRow(src.row(y), this->packRow.data());
+        GBitImage::pack_row(this->packRow.data(), dst.row(y), src.width);
+    }
+}
+
+OrderedDitherer::OrderedDitherer(OrderedPattern patternIn) : pattern(patternIn)
+{
+
+}
+
+void OrderedDitherer::setPattern(OrderedPattern patternIn)
+{
+    if (this->pattern != patternIn)
+        this->valid = false;
+
+    this->pattern = patternIn;
+}
+
+void OrderedDitherer::begin(uint32_t widthIn, unsigned char thresholdIn)
+{
+    if (this->valid && this->width == widthIn && this->threshold == thresholdIn)
+        return;
+
+    const Tile tile = pattern_tile(this->pattern);
+
+    this->width = widthIn;
+    this->threshold = thresholdIn;
+    this->tileSize = tile.size;
+    this->thresholds.resize(static_cast<std::size_t>(this->width) * this->tileSize);
+
+    // A pixel is set when it is above the threshold moved by the level, so a level of 128
+    // leaves the threshold as is and a flat gray lights up the matching share of the tile
+    for (uint32_t ty = 0; ty < this->tileSize; ty++)
+    {
+        unsigned char* row = this->thresholds.data() + static_cast<std::size_t>(ty) * this->width;
+
+        for (uint32_t x = 0; x < this->width; x++)
+        {
+            int level = tile.levels[ty * tile.size + x % tile.size];
+            row[x] = static_cast<unsigned char>(std::clamp(thresholdIn + level - 128, 0, UCHAR_MAX));
+        }
+    }
+
+    this->valid = true;
+}
+
+void OrderedDitherer::ditherRow(const unsigned char* in, unsigned char* out, uint32_t y) const
+{
+    this->ditherRow(in, out, y, 0, this->width);
+}
+
+void OrderedDitherer::ditherRow(const unsigned char* in, unsigned char* out, uint32_t y, uint32_t from, uint32_t to) const
+{
+    const unsigned char* row = this->thresholds.data() + static_cast<std::size_t>(y % this->tileSize) * this->width;
+    uint32_t x = from;
+
+#if DITHER_SSE2
+    // SSE2 only compares signed bytes, flipping the top bit maps the unsigned order onto it
+    const __m128i flip = _mm_set1_epi8(static_cast<char>(0x80));
+
+    for (; x + 16 <= to; x += 16)
+    {
+        __m128i px = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + x)), flip);
+        __m128i t = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x)), flip);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), _mm_cmpgt_epi8(px, t));
+    }
+#endif
+
+    for (; x < to; x++)
+        out[x] = (in[x] > row[x]) * UCHAR_MAX;
+}
+
+void OrderedDitherer::ditherRow(const unsigned char* in, uint64_t* out, uint32_t y) const
+{
+    const unsigned char* row = this->thresholds.data() + static_cast<std::size_t>(y % this->tileSize) * this->width;
+
+    for (uint32_t word = 0; word * 64 < this->width; word++)
+    {
+        const uint32_t start = word * 64;
+        const uint32_t end = std::min(start + 64, this->width);
+        uint64_t bits = 0;
+        uint32_t x = start;
+
+#if DITHER_SSE2
+        const __m128i flip = _mm_set1_epi8(static_cast<char>(0x80));
+
+        for (; x + 16 <= end; x += 16)
+        {
+            __m128i px = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + x)), flip);
+            __m128i t = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x)), flip);
+            bits |= static_cast<uint64_t>(_mm_movemask_epi8(_mm_cmpgt_epi8(px, t))) << (x - start);
+        }
+#endif
+
+        for (; x < end; x++)
+            bits |= static_cast<uint64_t>(in[x] > row[x]) << (x - start);
+
+        out[word] = bits;
+    }
+}
+
+void OrderedDitherer::dither(const GConstImageView& src, const GImageView& dst, unsigned char thresholdIn)
+{
+    this->begin(src.width, thresholdIn);
+
+    for (uint32_t y = 0; y < src.height; y++)
+        this->ditherRow(src.row(y), dst.row(y), y);
+}
+
+void OrderedDitherer::dither(const GConstImageView& src, GBitImage& dst, unsigned char thresholdIn)
+{
+    this->begin(src.width, thresholdIn);
+    dst.realloc_size(src.width, src.height);
+
+    for (uint32_t y = 0; y < src.height; y++)
+        this->ditherRow(src.row(y), dst.row(y), y);
+}
\ No newline at end of file
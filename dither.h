@@ -0,0 +1,82 @@
+#ifndef PNG2BR_DITHER_H
+#define PNG2BR_DITHER_H
+
+#include "image.h"
+
+#include <vector>
+
+/*
+ * Error diffusion over a small ring of int16 error rows, one for the current
+ * row and one for each row the kernel reaches below it. The rows are kept
+ * between images, so dithering frames of a constant width does not allocate.
+ *
+ * Serpentine scanning processes every other row from right to left with the
+ * kernel mirrored, which breaks up the diagonal artifacts of a fixed direction.
+ */
+class ErrorDiffuser
+{
+    public:
+        explicit ErrorDiffuser(DiffusionKernel kernel = DiffusionKernel::FloydSteinberg, bool serpentine = false);
+
+        void setKernel(DiffusionKernel kernel);
+        void setSerpentine(bool enabled);
+
+        // Starts a new image, its rows must then be passed to diffuseRow from top to bottom
+        void begin(uint32_t width, unsigned char threshold);
+        void diffuseRow(const unsigned char* in, unsigned char* out);
+
+        void diffuse(const GConstImageView& src, const GImageView& dst, unsigned char threshold);
+        void diffuse(const GConstImageView& src, GBitImage& dst, unsigned char threshold);
+
+    private:
+        // Stucki reaches two rows down and two pixels to either side
+        static constexpr uint32_t ROWS = 3;
+        static constexpr uint32_t BORDER = 2;
+
+        DiffusionKernel kernel;
+        bool serpentine;
+        uint32_t width = 0;
+        unsigned char threshold = 0;
+        int16_t bias = 0;
+        uint32_t row = 0;
+        std::vector<int16_t> errors;
+        // One dithered row on its way to a GBitImage
+        std::vector<unsigned char> packRow;
+};
+
+/*
+ * Ordered dithering against a tiled threshold matrix, either a Bayer matrix
+ * or a blue noise tile. The threshold rows of the tile are expanded to the
+ * image width up front, so dithering a row is a single compare per pixel,
+ * done 16 pixels at a time with SSE2 where available. Packed output takes
+ * the comparison's byte mask as the bits directly. Rows are independent
+ * and may be dithered from several threads once begin() was called.
+ */
+class OrderedDitherer
+{
+    public:
+        explicit OrderedDitherer(OrderedPattern pattern = OrderedPattern::Bayer8);
+
+        void setPattern(OrderedPattern pattern);
+
+        // Prepares the threshold rows, a no-op if nothing changed since the last call
+        void begin(uint32_t width, unsigned char threshold);
+        void ditherRow(const unsigned char* in, unsigned char* out, uint32_t y) const;
+        // Only dithers the columns [from, to) of the row
+        void ditherRow(const unsigned char* in, unsigned char* out, uint32_t y, uint32_t from, uint32_t to) const;
+        // Packed, see GBitImage
+        void ditherRow(const unsigned char* in, uint64_t* out, uint32_t y) const;
+
+        void dither(const GConstImageView& src, const GImageView& dst, unsigned char threshold);
+        void dither(const GConstImageView& src, GBitImage& dst, unsigned char threshold);
+
+    private:
+        OrderedPattern pattern;
+        bool valid = false;
+        uint32_t width = 0;
+        unsigned char threshold = 0;
+        uint32_t tileSize = 0;
+        std::vector<unsigned char> thresholds;
+};
+
+#endif //PNG2BR_DITHER_H
\ No newline at end of file
@@ -0,0 +1,470 @@
+#ifndef PNG2BR_FRAMEPIPELINE_H
+#define PNG2BR_FRAMEPIPELINE_H
+
+#include "reorderwindow.h"
+#include "spscring.h"
+#include "videodecoder.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+/*
+ * Decodes a video and processes its frames on a staged set of threads:
+ *
+ *     demux -> decode -> N workers -> reorder -> consumer
+ *
+ * Packets go from the demuxer to the decoder through an SPSCRing, decoded
+ * frames wait in a bounded queue for the next free worker. Workers process
+ * frames out of order and the reorder stage hands them to the consumer in
+ * presentation order. Every stage blocks once its queue is full, so memory
+ * stays bounded whichever stage is the bottleneck.
+ *
+ * Frames are numbered in the order the decoder outputs them, which already
+ * is presentation order, so the reorder buffer is keyed by that number
+ * rather than by the raw PTS, which may be missing or repeated.
+ *
+ * Processing that depends on the previous frame (e.g. threshold smoothing)
+ * goes between beginOrdered() and endOrdered(), which admit one frame at a
+ * time in presentation order. Every frame has to take its turn, so the
+ * pipeline closes the turn of any frame whose processing did not.
+ */
+template<typename Result>
+class FramePipeline
+{
+    public:
+        struct Config
+        {
+            // Demuxed packets waiting for the decoder
+            std::size_t packetQueueDepth = 64;
+            // Decoded frames waiting for a worker
+            std::size_t frameQueueDepth = 4;
+            // How many frames workers may run ahead of the consumer, 0 for twice the worker count
+            std::size_t reorderDepth = 0;
+            // 0 for all cores
+            uint32_t workers = 0;
+        };
+
+        // Owned by the packet queue, filled by the demuxer and unreferenced once decoded
+        struct PacketSlot
+        {
+            PacketSlot() : packet(av_packet_alloc())
+            {
+                if (!this->packet)
+                    throw std::runtime_error("Could not allocate packet");
+            }
+
+            PacketSlot(const PacketSlot&) = delete;
+            PacketSlot& operator=(const PacketSlot&) = delete;
+
+            ~PacketSlot()
+            {
+                av_packet_free(&this->packet);
+            }
+
+            AVPacket* packet;
+        };
+
+        struct Frame
+        {
+            // Position in presentation order, starting at 0
+            uint64_t index = 0;
+            double pts = 0;
+            // Released by the pipeline once processed
+            VideoFrame source;
+            Result result;
+        };
+
+        struct Stats
+        {
+            uint64_t frames = 0;
+            // Times the decoder found the frame queue full and the consumer had to wait for the next frame
+            uint64_t decoderStalls = 0;
+            uint64_t consumerStalls = 0;
+            // Most processed frames waiting for the consumer at once
+            std::size_t maxReordered = 0;
+        };
+
+        // Called concurrently on the worker threads, each call for a different frame. It may call
+        // beginOrdered() and endOrdered() for its frame once each, in that order. A turn left open
+        // (e.g. by an early return) is closed once it returns, later frames wait for it until then
+        typedef std::function<void(Frame&)> Process;
+
+        FramePipeline(VideoDecoder& decoderIn, const Config& configIn) : decoder(decoderIn), config(configIn), packets(std::max<std::size_t>(configIn.packetQueueDepth, 1))
+        {
+            if (!this->config.workers)
+                this->config.workers = std::max(std::thread::hardware_concurrency(), 1u);
+
+            if (!this->config.reorderDepth)
+                this->config.reorderDepth = 2 * static_cast<std::size_t>(this->config.workers);
+
+            // A window narrower than the pool would leave workers idle
+            this->config.reorderDepth = std::max<std::size_t>(this->config.reorderDepth, this->config.workers);
+            this->config.frameQueueDepth = std::max<std::size_t>(this->config.frameQueueDepth, 1);
+
+            // In flight frames are either queued or within the reorder window
+            this->frames.resize(this->config.frameQueueDepth + this->config.reorderDepth);
+            this->window = ReorderWindow<Frame*>(this->config.reorderDepth);
+
+            for (Frame& frame : this->frames)
+                this->freeFrames.push_back(&frame);
+        }
+
+        FramePipeline(const FramePipeline&) = delete;
+        FramePipeline& operator=(const FramePipeline&) = delete;
+
+        ~FramePipeline()
+        {
+            this->fail(nullptr);
+
+            for (std::thread& thread : this->threads)
+                thread.join();
+        }
+
+        void start(Process processIn)
+        {
+            if (!this->threads.empty())
+                throw std::logic_error("The pipeline is already running");
+
+            this->process = std::move(processIn);
+
+            this->threads.emplace_back([this] { this->demux(); });
+            this->threads.emplace_back([this] { this->decode(); });
+
+            for (uint32_t i = 0; i < this->config.workers; i++)
+                this->threads.emplace_back([this] { this->work(); });
+        }
+
+        // Consumer: the next frame in presentation order, waits until it is processed, nullptr at the end.
+        // Rethrows the first exception of any stage
+        Frame* front()
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+
+            auto available = [this] {
+                return this->stopping || this->window.ready()
+                       || (this->decodedAll && this->window.getConsumed() == this->decodedFrames);
+            };
+
+            if (!available())
+            {
+                this->stats.consumerStalls++;
+                this->frameDone.wait(lock, available);
+            }
+
+            if (this->error)
+                std::rethrow_exception(this->error);
+
+            // Otherwise all frames were consumed
+            return !this->stopping && this->window.ready() ? this->window.front() : nullptr;
+        }
+
+        // Consumer: hands the frame returned by front() back to the decoder
+        void pop()
+        {
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+
+                this->freeFrames.push_back(this->window.front());
+                this->window.pop();
+
+                this->reordered--;
+                this->stats.frames++;
+            }
+
+            this->frameFree.notify_one();
+            // Moves the reorder window
+            this->workAvailable.notify_all();
+        }
+
+        // Worker: waits until all earlier frames passed endOrdered()
+        void beginOrdered(const Frame& frame)
+        {
+            uint64_t turn;
+
+            while ((turn = this->orderedTurn.load(std::memory_order_acquire)) < frame.index)
+                this->orderedTurn.wait(turn, std::memory_order_acquire);
+        }
+
+        void endOrdered(const Frame& frame)
+        {
+            uint64_t expected = frame.index;
+
+            // Stays open for everyone once the pipeline failed
+            if (this->orderedTurn.compare_exchange_strong(expected, frame.index + 1, std::memory_order_release))
+                this->orderedTurn.notify_all();
+        }
+
+        [[nodiscard]] const Config& getConfig() const
+        {
+            return this->config;
+        }
+
+        [[nodiscard]] Stats getStats() const
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            return this->stats;
+        }
+
+        // Decoded frames not handed to the consumer yet
+        [[nodiscard]] std::size_t size() const
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            return this->frames.size() - this->freeFrames.size();
+        }
+
+        [[nodiscard]] std::size_t capacity() const
+        {
+            return this->frames.size();
+        }
+
+        [[nodiscard]] typename SPSCRing<PacketSlot>::Stats getPacketStats() const
+        {
+            return this->packets.getStats();
+        }
+
+    private:
+        // Stops all stages, nullptr for a regular shutdown
+        void fail(std::exception_ptr e)
+        {
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+
+                if (e && !this->error)
+                    this->error = e;
+
+                this->stopping = true;
+            }
+
+            this->frameFree.notify_all();
+            this->workAvailable.notify_all();
+            this->frameDone.notify_all();
+
+            this->orderedTurn.store(std::numeric_limits<uint64_t>::max(), std::memory_order_release);
+            this->orderedTurn.notify_all();
+        }
+
+        // The turn counter only moves past a frame in its endOrdered(), so it tells whether the frame's turn is still open
+        void closeOrdered(const Frame& frame)
+        {
+            if (this->orderedTurn.load(std::memory_order_acquire) > frame.index)
+                return;
+
+            this->beginOrdered(frame);
+            this->endOrdered(frame);
+        }
+
+        [[nodiscard]] bool isStopping()
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            return this->stopping;
+        }
+
+        void demux()
+        {
+            try
+            {
+                while (!this->isStopping())
+                {
+                    PacketSlot& slot = this->packets.acquire();
+
+                    if (!this->decoder.readPacket(slot.packet))
+                        break;
+
+                    this->packets.publish();
+                }
+            }
+            catch (...)
+            {
+                this->fail(std::current_exception());
+            }
+
+            this->packets.close();
+        }
+
+        void decode()
+        {
+            Frame* frame = nullptr;
+
+            // Moves every frame the decoder has ready to the frame queue
+            auto drain = [&] () -> bool {
+                while (true)
+                {
+                    if (!frame)
+                    {
+                        std::unique_lock<std::mutex> lock(this->mutex);
+
+                        auto free = [this] {
+                            return this->stopping || (!this->freeFrames.empty() && this->queued.size() < this->config.frameQueueDepth);
+                        };
+
+                        if (!free())
+                        {
+                            this->stats.decoderStalls++;
+                            this->frameFree.wait(lock, free);
+                        }
+
+                        if (this->stopping)
+                            return false;
+
+                        frame = this->freeFrames.back();
+                        this->freeFrames.pop_back();
+                    }
+
+                    if (!this->decoder.receiveFrame(frame->source))
+                        return true;
+
+                    {
+                        std::lock_guard<std::mutex> lock(this->mutex);
+
+                        frame->index = this->decodedFrames++;
+                        frame->pts = frame->source.getPTS();
+                        this->queued.push_back(frame);
+                        frame = nullptr;
+                    }
+
+                    this->workAvailable.notify_one();
+                }
+            };
+
+            try
+            {
+                bool running = true;
+
+                while (running)
+                {
+                    PacketSlot* slot = this->packets.front();
+
+                    if (!slot)
+                        break;
+
+                    this->decoder.sendPacket(slot->packet);
+                    av_packet_unref(slot->packet);
+                    this->packets.pop();
+
+                    running = drain();
+                }
+
+                if (running)
+                {
+                    this->decoder.sendPacket(nullptr);
+                    running = drain();
+                }
+
+                if (running)
+                {
+                    {
+                        std::lock_guard<std::mutex> lock(this->mutex);
+                        this->decodedAll = true;
+                    }
+
+                    this->workAvailable.notify_all();
+                    this->frameDone.notify_all();
+                }
+            }
+            catch (...)
+            {
+                this->fail(std::current_exception());
+            }
+
+            // The demuxer may still wait for a free packet slot
+            while (PacketSlot* slot = this->packets.front())
+            {
+                av_packet_unref(slot->packet);
+                this->packets.pop();
+            }
+        }
+
+        void work()
+        {
+            while (true)
+            {
+                Frame* frame;
+
+                {
+                    std::unique_lock<std::mutex> lock(this->mutex);
+
+                    // The queue is in presentation order, the window keeps the reorder buffer bounded
+                    this->workAvailable.wait(lock, [this] {
+                        return this->stopping || (this->decodedAll && this->queued.empty())
+                               || (!this->queued.empty() && this->window.admits(this->queued.front()->index));
+                    });
+
+                    if (this->stopping || this->queued.empty())
+                        return;
+
+                    frame = this->queued.front();
+                    this->queued.pop_front();
+                }
+
+                this->frameFree.notify_one();
+
+                try
+                {
+                    this->process(*frame);
+                    this->closeOrdered(*frame);
+                    frame->source.release();
+                }
+                catch (...)
+                {
+                    this->fail(std::current_exception());
+                    return;
+                }
+
+                bool next;
+
+                {
+                    std::lock_guard<std::mutex> lock(this->mutex);
+
+                    this->window.at(frame->index) = frame;
+                    this->window.complete(frame->index);
+                    this->reordered++;
+                    this->stats.maxReordered = std::max(this->stats.maxReordered, this->reordered);
+                    next = frame->index == this->window.getConsumed();
+                }
+
+                if (next)
+                    this->frameDone.notify_one();
+            }
+        }
+
+        VideoDecoder& decoder;
+        Config config;
+        Process process;
+
+        SPSCRing<PacketSlot> packets;
+
+        mutable std::mutex mutex;
+        std::condition_variable frameFree;
+        std::condition_variable workAvailable;
+        std::condition_variable frameDone;
+
+        std::vector<Frame> frames;
+        std::vector<Frame*> freeFrames;
+        std::deque<Frame*> queued;
+        // Processed frames waiting for the consumer, spans reorderDepth frames
+        ReorderWindow<Frame*> window;
+        std::size_t reordered = 0;
+
+        uint64_t decodedFrames = 0;
+        bool decodedAll = false;
+        bool stopping = false;
+        std::exception_ptr error;
+        Stats stats;
+
+        std::atomic<uint64_t> orderedTurn{ 0 };
+
+        std::vector<std::thread> threads;
+};
+
+#endif //PNG2BR_FRAMEPIPELINE_H
\ No newline at end of file
@@ -3,16 +3,29 @@
 //
 
 #include "image.h"
+#include "dither.h"
+#include "resampler.h"
 
 #include <png.h>
 
+#include <algorithm>
+#include <atomic>
 #include <fstream>
 #include <functional>
 #include <iostream>
 #include <stdexcept>
+#include <thread>
+#include <vector>
 
 #include <climits>
+#include <csetjmp>
 #include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IMAGE_SSE2 1
+#include <emmintrin.h>
+#endif
 
 GImage::GImage(const std::filesystem::path &filename)
 {
@@ -21,11 +34,19 @@ GImage::GImage(const std::filesystem::path &filename)
     if (!input_file)
         throw std::runtime_error("Failed to open file: " + filename.string());
 
+    // Errors are thrown from the setjmp() below, so they are kept instead of printed
+    std::string error;
+
     auto err_func = [] (png_structp png_ptr, png_const_charp error_msg) -> void {
-        std::cerr << error_msg << std::endl;
+        *static_cast<std::string *>(png_get_error_ptr(png_ptr)) = error_msg;
+        png_longjmp(png_ptr, 1);
+    };
+
+    auto warn_func = [] (png_structp png_ptr, png_const_charp warning_msg) -> void {
+        std::cerr << warning_msg << std::endl;
     };
 
-    png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, err_func, err_func);
+    png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, &error, err_func, warn_func);
 
     if (png == nullptr)
         throw std::runtime_error("Failed to create the PNG read struct.");
@@ -33,6 +54,10 @@ GImage::GImage(const std::filesystem::path &filename)
     png_rw_ptr read_func = [] (png_structp png_ptr, png_bytep data, size_t length) -> void {
         auto *input_file = static_cast<std::ifstream *>(png_get_io_ptr(png_ptr));
         input_file->read(reinterpret_cast<char *>(data), length);
+
+        // Otherwise libpng decodes whatever was left in its buffer
+        if (static_cast<size_t>(input_file->gcount()) != length)
+            png_error(png_ptr, "Unexpected end of file");
     };
 
     png_set_read_fn(png, &input_file, read_func);
@@ -42,6 +67,16 @@ GImage::GImage(const std::filesystem::path &filename)
     if (info == nullptr)
         throw std::runtime_error("Failed to create the PNG info struct.");
 
+    this->bitmap = nullptr;
+
+    // err_func jumps back here on a broken file
+    if (setjmp(png_jmpbuf(png)))
+    {
+        png_destroy_read_struct(&png, &info, nullptr);
+        delete[] this->bitmap;
+        throw std::runtime_error("Failed to read the PNG file: " + error);
+    }
+
     png_read_info(png, info);
 
     this->width = png_get_image_width(png, info);
@@ -58,7 +93,7 @@ GImage::GImage(const std::filesystem::path &filename)
     if (png_get_valid(png, info, PNG_INFO_tRNS) != 0)
         png_set_tRNS_to_alpha(png);
 
-    png_color_16 bgcolor;
+    png_color_16 bgcolor{};
     png_set_background(png, &bgcolor, PNG_BACKGROUND_GAMMA_FILE, 0, 1.0);
 
     if (color_type & PNG_COLOR_MASK_ALPHA)
@@ -97,9 +132,16 @@ GImage::GImage() : GImage(0, 0)
 
 GImage& GImage::operator=(GImage&& other) noexcept
 {
+    if (this == &other)
+        return *this;
+
+    delete[] this->bitmap;
+
     this->width = other.width;
     this->height = other.height;
     this->bitmap = other.bitmap;
+    other.width = 0;
+    other.height = 0;
     other.bitmap = nullptr;
 
     return *this;
@@ -185,45 +227,60 @@ GImage::GImage(GImage&& other) noexcept
     this->width = other.width;
     this->height = other.height;
     this->bitmap = other.bitmap;
+    other.width = 0;
+    other.height = 0;
     other.bitmap = nullptr;
 }
 
 GImage GImage::resize_bilinear(uint32_t new_width, uint32_t new_height) const
 {
     GImage output(new_width, new_height);
+    kernels::resize_bilinear(this->view(), output.view());
+    return output;
+}
 
-    for (uint32_t y = 0; y < new_height; y++)
-    {
-        for (uint32_t x = 0; x < new_width; x++)
-        {
-            double sx = static_cast<double>(x) / new_width * this->width;
-            double sy = static_cast<double>(y) / new_height * this->height;
-
-            auto cx = static_cast<uint32_t>(std::ceil(sx));
-            auto cy = static_cast<uint32_t>(std::ceil(sy));
-            auto fx = static_cast<uint32_t>(std::floor(sx));
-            auto fy = static_cast<uint32_t>(std::floor(sy));
+GImage GImage::dither(unsigned char threshold, uint32_t threads) const
+{
+    GImage output(this->width, this->height);
+    kernels::dither(this->view(), output.view(), threshold, threads);
+    return output;
+}
 
-            double fract_x = sx - std::floor(sx);
-            double fract_y = sy - std::floor(sy);
+GImage GImage::dither(unsigned char threshold, DiffusionKernel kernel, bool serpentine) const
+{
+    GImage output(this->width, this->height);
+    kernels::dither(this->view(), output.view(), threshold, kernel, serpentine);
+    return output;
+}
 
-            double sample0 = this->operator[]({fx, fy}) * (1 - fract_x) * (1 - fract_y);
-            double sample1 = this->operator[]({cx, fy}) *       fract_x * (1 - fract_y);
-            double sample2 = this->operator[]({fx, cy}) * (1 - fract_x) *      fract_y;
-            double sample3 = this->operator[]({cx, cy}) *       fract_x *      fract_y;
+GImage GImage::dither_ordered(unsigned char threshold, OrderedPattern pattern) const
+{
+    GImage output(this->width, this->height);
+    kernels::dither_ordered(this->view(), output.view(), threshold, pattern);
+    return output;
+}
 
-            auto sample = static_cast<unsigned char>(sample0 + sample1 + sample2 + sample3);
+GImage GImage::binary_threshold(unsigned char threshold) const
+{
+    GImage output(this->width, this->height);
+    kernels::binary_threshold(this->view(), output.view(), threshold);
+    return output;
+}
 
-            output[uvec2{x, y}] = sample;
-        }
-    }
+GImage &GImage::gamma_correct(double correction)
+{
+    kernels::gamma_correct(this->view(), this->view(), correction);
+    return *this;
+}
 
-    return output;
+GImage::Histogram GImage::getHistogram(uint32_t step) const
+{
+    return kernels::histogram(this->view(), step);
 }
 
 void GImage::realloc_size(uint32_t new_width, uint32_t new_height)
 {
-    if (this->width == new_width && this->height == new_height)
+    if (this->width == new_width && this->height == new_height && this->bitmap != nullptr)
         return;
 
     delete[] this->bitmap;
@@ -239,95 +296,6 @@ void GImage::realloc_size(uint32_t new_width, uint32_t new_height)
     std::fill_n(this->bitmap, this->width * this->height, 0);
 }
 
-GImage GImage::dither(unsigned char threshold) const
-{
-    GImage output(this->width, this->height);
-
-    constexpr uint32_t border = 1;
-    uint32_t err_buf_w = this->width + border * 2;
-    uint32_t err_buf_h = this->height + border * 2;
-    int *err_buf = new int[err_buf_w * err_buf_h];
-    int bias = UCHAR_MAX / 2 - threshold;
-    std::fill_n(err_buf, err_buf_w * err_buf_h, bias);
-
-    auto err_buf_add = [=] (uvec2 xy, int error) -> void {
-        err_buf[(xy.x + border) + (xy.y + border) * err_buf_w] += error;
-    };
-
-    auto err_buf_get = [=] (uvec2 xy) -> int {
-        return err_buf[(xy.x + border) + (xy.y + border) * err_buf_w];
-    };
-
-    uvec2 pos{};
-
-    for (uint32_t y = 0; y < output.height; y++)
-    {
-        pos.y = y;
-
-        for (uint32_t x = 0; x < output.width; x++)
-        {
-            pos.x = x;
-
-            int pixel = (*this)[pos] + err_buf_get(pos);
-            unsigned char color = (threshold < pixel) * UCHAR_MAX;
-            int error = pixel - color;
-            err_buf_add({x + 1, y}, error * 7 / 16);
-            err_buf_add({x - 1, y + 1}, error * 3 / 16);
-            err_buf_add({x, y + 1}, error * 5 / 16);
-            err_buf_add({x + 1, y + 1}, error * 1 / 16);
-
-            output[pos] = color;
-        }
-    }
-
-    delete[] err_buf;
-
-    return output;
-}
-
-GImage GImage::dither_ordered(unsigned char threshold) const
-{
-    GImage output(this->width, this->height);
-
-    constexpr uint32_t bit_shift = 1u;
-    constexpr uint32_t mask_size = 1u << bit_shift;
-    constexpr uint32_t mask_pixels = mask_size * mask_size;
-    static unsigned int mask[mask_size][mask_size] = {
-            { 0, 2 },
-            { 3, 1 }
-    };
-
-    threshold /= mask_pixels;
-
-    uvec2 pos{};
-
-    for (uint32_t y = 0; y < output.height; y++)
-    {
-        pos.y = y;
-
-        for (uint32_t x = 0; x < output.width; x++)
-        {
-            pos.x = x;
-
-            output[pos] = ((this->operator[](pos) * mask[x & bit_shift][y & bit_shift] / mask_pixels) > threshold) * UCHAR_MAX;
-        }
-    }
-
-    return output;
-}
-
-GImage GImage::binary_threshold(unsigned char threshold) const
-{
-    GImage output(this->width, this->height);
-
-    for (uint32_t i = 0; i < output.width * output.height; i++)
-    {
-        output.bitmap[i] = (this->bitmap[i] > threshold) * UCHAR_MAX;
-    }
-
-    return output;
-}
-
 GImage GImage::invert() const
 {
     GImage output(this->width, this->height);
@@ -350,10 +318,10 @@ GImage &GImage::invert_in_place()
     return *this;
 }
 
-GImage &GImage::gamma_correct(double correction)
+GImage::LUT GImage::gamma_lut(double correction)
 {
     constexpr unsigned char lutMax = UCHAR_MAX;
-    unsigned char lut[lutMax + 1];
+    LUT lut;
 
     for (uint32_t i = 0; i <= lutMax; i++)
     {
@@ -363,38 +331,56 @@ GImage &GImage::gamma_correct(double correction)
         lut[i] = static_cast<unsigned char>(val);
     }
 
-    const uint32_t bufsize = this->width * this->height;
+    return lut;
+}
+
+GImage::LUT GImage::limited_range_lut()
+{
+    constexpr int black = 16;
+    constexpr int white = 235;
+    LUT lut;
 
-    for (uint32_t i = 0; i < bufsize; i++)
+    for (int i = 0; i < static_cast<int>(levels); i++)
     {
-        this->bitmap[i] = lut[this->bitmap[i]];
+        int expanded = ((i - black) * UCHAR_MAX + (white - black) / 2) / (white - black);
+        lut[i] = static_cast<unsigned char>(std::clamp(expanded, 0, static_cast<int>(UCHAR_MAX)));
     }
 
-    return *this;
+    return lut;
+}
+
+GImage::LUT GImage::compose_lut(const LUT& first, const LUT& second)
+{
+    LUT lut;
+
+    for (uint32_t i = 0; i < levels; i++)
+        lut[i] = second[first[i]];
+
+    return lut;
 }
 
-GImage::Histogram GImage::getHistogram() const
+GImage::Histogram GImage::map_histogram(const Histogram& histogram, const LUT& lut)
 {
-    Histogram histogram;
+    Histogram mapped;
 
-    histogram.fill(0);
+    mapped.fill(0);
 
-    for (uint32_t i = 0; i < this->width * this->height; i++)
-    {
-        unsigned char level = this->bitmap[i];
-        histogram[level]++;
-    }
+    for (uint32_t i = 0; i < levels; i++)
+        mapped[lut[i]] += histogram[i];
 
-    // Bias towards lighter colors
-    histogram[0] = 0;
+    // Keep the same bias as getHistogram() for levels mapped to black
+    mapped[0] = 0;
 
-    return histogram;
+    return mapped;
 }
 
+unsigned char GImage::otsu(uint32_t step) const
+{
+    return GImage::otsu(this->getHistogram(step));
+}
 
-unsigned char GImage::otsu() const
+unsigned char GImage::otsu(const Histogram& hs)
 {
-    Histogram hs = this->getHistogram();
 
     uint32_t pixels = 0;
     for (uint32_t i = 0; i < levels; i++)
@@ -448,4 +434,437 @@ unsigned char* GImage::data()
 const unsigned char* GImage::data() const
 {
     return this->bitmap;
+}
+
+GImageView GImage::view()
+{
+    return { this->bitmap, this->width, this->height, this->width };
+}
+
+GConstImageView GImage::view() const
+{
+    return { this->bitmap, this->width, this->height, this->width };
+}
+
+GBitImage::GBitImage(uint32_t widthIn, uint32_t heightIn)
+{
+    this->realloc_size(widthIn, heightIn);
+}
+
+GBitImage::GBitImage() : GBitImage(0, 0)
+{
+
+}
+
+GBitImage::GBitImage(const GConstImageView& img)
+{
+    this->pack(img);
+}
+
+uint32_t GBitImage::getWidth() const
+{
+    return this->width;
+}
+
+uint32_t GBitImage::getHeight() const
+{
+    return this->height;
+}
+
+std::size_t GBitImage::getWordsPerRow() const
+{
+    return this->wordsPerRow;
+}
+
+bool GBitImage::operator[](const uvec2 &xy) const
+{
+    return (this->row(xy.y)[xy.x / 64] >> (xy.x % 64)) & 1;
+}
+
+void GBitImage::set(const uvec2 &xy, bool raised)
+{
+    uint64_t& word = this->row(xy.y)[xy.x / 64];
+    const uint64_t bit = uint64_t(1) << (xy.x % 64);
+
+    word = raised ? word | bit : word & ~bit;
+}
+
+uint64_t* GBitImage::row(uint32_t y)
+{
+    return this->words.data() + y * this->wordsPerRow;
+}
+
+const uint64_t* GBitImage::row(uint32_t y) const
+{
+    return this->words.data() + y * this->wordsPerRow;
+}
+
+void GBitImage::realloc_size(uint32_t new_width, uint32_t new_height)
+{
+    if (this->width == new_width && this->height == new_height)
+        return;
+
+    if (new_width > GImage::MAX_SIZE || new_height > GImage::MAX_SIZE)
+        throw std::runtime_error("Image dimensions cannot exceed " + std::to_string(GImage::MAX_SIZE) + "!");
+
+    this->width = new_width;
+    this->height = new_height;
+    this->wordsPerRow = words_per_row(new_width);
+    this->words.assign(this->wordsPerRow * new_height, 0);
+}
+
+void GBitImage::pack(const GConstImageView& img)
+{
+    this->realloc_size(img.width, img.height);
+
+    for (uint32_t y = 0; y < img.height; y++)
+        pack_row(img.row(y), this->row(y), img.width);
+}
+
+void GBitImage::unpack(const GImageView& img) const
+{
+    if (img.width != this->width || img.height != this->height)
+        throw std::runtime_error("Source and destination image dimensions do not match!");
+
+    for (uint32_t y = 0; y < this->height; y++)
+    {
+        const uint64_t* in = this->row(y);
+        unsigned char* out = img.row(y);
+
+        for (uint32_t x = 0; x < this->width; x++)
+            out[x] = ((in[x / 64] >> (x % 64)) & 1) * UCHAR_MAX;
+    }
+}
+
+GImage GBitImage::to_image() const
+{
+    GImage output(this->width, this->height);
+    this->unpack(output.view());
+    return output;
+}
+
+void GBitImage::pack_row(const unsigned char* in, uint64_t* out, uint32_t width)
+{
+    for (uint32_t word = 0; word * 64 < width; word++)
+    {
+        const uint32_t start = word * 64;
+        const uint32_t end = std::min(start + 64, width);
+        uint64_t bits = 0;
+        uint32_t x = start;
+
+#if IMAGE_SSE2
+        const __m128i zero = _mm_setzero_si128();
+
+        // The mask has a bit for every zero byte
+        for (; x + 16 <= end; x += 16)
+        {
+            __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + x));
+            bits |= static_cast<uint64_t>(~_mm_movemask_epi8(_mm_cmpeq_epi8(px, zero)) & 0xFFFF) << (x - start);
+        }
+#endif
+
+        for (; x < end; x++)
+            bits |= static_cast<uint64_t>(in[x] != 0) << (x - start);
+
+        out[word] = bits;
+    }
+}
+
+std::size_t GBitImage::words_per_row(uint32_t width)
+{
+    return (static_cast<std::size_t>(width) + 63) / 64;
+}
+
+static void check_same_size(const GConstImageView& src, const GConstImageView& dst)
+{
+    if (src.width != dst.width || src.height != dst.height)
+        throw std::runtime_error("Source and destination image dimensions do not match!");
+}
+
+void kernels::resize_bilinear(const GConstImageView& src, const GImageView& dst)
+{
+    auto resampler = BilinearResampler::cached(src.width, src.height, dst.width, dst.height);
+    resampler->resize(src.data, src.stride, dst.data, dst.stride);
+}
+
+namespace
+{
+    // Pixels a row finishes between progress updates
+    constexpr uint32_t WAVEFRONT_CHUNK = 32;
+    // Below this width the rows finish too quickly to be worth synchronising
+    constexpr uint32_t WAVEFRONT_MIN_WIDTH = 128;
+
+    struct alignas(64) RowProgress
+    {
+        std::atomic<uint32_t> done{ 0 };
+    };
+
+    uint32_t wait_for_progress(const RowProgress& row, uint32_t needed)
+    {
+        uint32_t done;
+
+        while ((done = row.done.load(std::memory_order_acquire)) < needed)
+            std::this_thread::yield();
+
+        return done;
+    }
+}
+
+/*
+ * Rows are handed out round robin to the threads. A pixel only receives error
+ * from the three pixels above it and from its left neighbour, so a row may
+ * process pixel x as soon as the row above has finished pixel x + 1. The
+ * error pushed down is kept per row in a ring of threads + 1 buffers, the
+ * error to the right stays in a register. The additions happen in the same
+ * order as in the sequential version, so the output is bit-identical.
+ *
+ * Row y is dithered into rowOut(y) and handed to rowDone(y) once complete,
+ * both on the thread that dithered it.
+ */
+template<typename RowOut, typename RowDone>
+static void dither_wavefront(const GConstImageView& src, unsigned char threshold, uint32_t threads, RowOut rowOut, RowDone rowDone)
+{
+    constexpr uint32_t border = 1;
+    const uint32_t width = src.width;
+    const uint32_t height = src.height;
+    const uint32_t buf_w = width + border * 2;
+    const uint32_t slots = threads + 1;
+    const int bias = UCHAR_MAX / 2 - threshold;
+
+    std::vector<int> below(static_cast<std::size_t>(buf_w) * slots, bias);
+    std::vector<RowProgress> progress(height);
+
+    auto worker = [&] (uint32_t first) -> void {
+        for (uint32_t y = first; y < height; y += threads)
+        {
+            const int* err_in = below.data() + (y % slots) * buf_w + border;
+            int* err_out = below.data() + ((y + 1) % slots) * buf_w + border;
+
+            // The slot was last read by row y - threads, which ran on this thread
+            std::fill_n(err_out - border, buf_w, bias);
+
+            const unsigned char* in = src.row(y);
+            unsigned char* out = rowOut(y);
+            uint32_t ready = y == 0 ? width : 0;
+            int err_right = 0;
+
+            for (int x = 0; x < static_cast<int>(width); x++)
+            {
+                uint32_t needed = std::min<uint32_t>(x + 2, width);
+
+                if (ready < needed)
+                    ready = wait_for_progress(progress[y - 1], needed);
+
+                int pixel = in[x] + err_in[x] + err_right;
+                unsigned char color = (threshold < pixel) * UCHAR_MAX;
+                int error = pixel - color;
+                err_right = error * 7 / 16;
+                err_out[x - 1] += error * 3 / 16;
+                err_out[x] += error * 5 / 16;
+                err_out[x + 1] += error * 1 / 16;
+
+                out[x] = color;
+
+                if ((x + 1) % WAVEFRONT_CHUNK == 0 || x + 1 == static_cast<int>(width))
+                    progress[y].done.store(x + 1, std::memory_order_release);
+            }
+
+            rowDone(y, out);
+        }
+    };
+
+    std::vector<std::thread> pool;
+    pool.reserve(threads - 1);
+
+    for (uint32_t t = 1; t < threads; t++)
+        pool.emplace_back(worker, t);
+
+    worker(0);
+
+    for (auto& thread : pool)
+        thread.join();
+}
+
+void kernels::dither(const GConstImageView& src, const GImageView& dst, unsigned char threshold, uint32_t threads)
+{
+    check_same_size(src, dst);
+
+    if (threads == 0)
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+    threads = std::min(threads, src.height);
+
+    if (threads <= 1 || src.width < WAVEFRONT_MIN_WIDTH)
+        kernels::dither(src, dst, threshold, DiffusionKernel::FloydSteinberg);
+    else
+        dither_wavefront(src, threshold, threads, [&dst] (uint32_t y) { return dst.row(y); }, [] (uint32_t, unsigned char*) {});
+}
+
+void kernels::dither(const GConstImageView& src, const GImageView& dst, unsigned char threshold, DiffusionKernel kernel, bool serpentine)
+{
+    check_same_size(src, dst);
+
+    // Keeps the error rows around for the next frame
+    thread_local ErrorDiffuser diffuser;
+
+    diffuser.setKernel(kernel);
+    diffuser.setSerpentine(serpentine);
+    diffuser.diffuse(src, dst, threshold);
+}
+
+void kernels::dither_ordered(const GConstImageView& src, const GImageView& dst, unsigned char threshold, OrderedPattern pattern)
+{
+    check_same_size(src, dst);
+
+    // Keeps the threshold rows around while the size and threshold stay the same
+    thread_local OrderedDitherer ditherer;
+
+    ditherer.setPattern(pattern);
+    ditherer.dither(src, dst, threshold);
+}
+
+void kernels::binary_threshold(const GConstImageView& src, const GImageView& dst, unsigned char threshold)
+{
+    check_same_size(src, dst);
+
+    for (uint32_t y = 0; y < src.height; y++)
+    {
+        const unsigned char* in = src.row(y);
+        unsigned char* out = dst.row(y);
+
+        for (uint32_t x = 0; x < src.width; x++)
+            out[x] = (in[x] > threshold) * UCHAR_MAX;
+    }
+}
+
+void kernels::dither(const GConstImageView& src, GBitImage& dst, unsigned char threshold, uint32_t threads)
+{
+    if (threads == 0)
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+    threads = std::min(threads, src.height);
+
+    if (threads <= 1 || src.width < WAVEFRONT_MIN_WIDTH)
+    {
+        kernels::dither(src, dst, threshold, DiffusionKernel::FloydSteinberg);
+        return;
+    }
+
+    dst.realloc_size(src.width, src.height);
+
+    // Row y is always dithered by thread y % threads, which packs it right after
+    std::vector<unsigned char> rows(static_cast<std::size_t>(src.width) * threads);
+
+    dither_wavefront(src, threshold, threads,
+                     [&] (uint32_t y) { return rows.data() + static_cast<std::size_t>(y % threads) * src.width; },
+                     [&] (uint32_t y, unsigned char* row) { GBitImage::pack_row(row, dst.row(y), src.width); });
+}
+
+void kernels::dither(const GConstImageView& src, GBitImage& dst, unsigned char threshold, DiffusionKernel kernel, bool serpentine)
+{
+    thread_local ErrorDiffuser diffuser;
+
+    diffuser.setKernel(kernel);
+    diffuser.setSerpentine(serpentine);
+    diffuser.diffuse(src, dst, threshold);
+}
+
+void kernels::dither_ordered(const GConstImageView& src, GBitImage& dst, unsigned char threshold, OrderedPattern pattern)
+{
+    thread_local OrderedDitherer ditherer;
+
+    ditherer.setPattern(pattern);
+    ditherer.dither(src, dst, threshold);
+}
+
+void kernels::binary_threshold(const GConstImageView& src, GBitImage& dst, unsigned char threshold)
+{
+    dst.realloc_size(src.width, src.height);
+
+    for (uint32_t y = 0; y < src.height; y++)
+    {
+        const unsigned char* in = src.row(y);
+        uint64_t* out = dst.row(y);
+
+        for (uint32_t word = 0; word * 64 < src.width; word++)
+        {
+            const uint32_t start = word * 64;
+            const uint32_t end = std::min(start + 64, src.width);
+            uint64_t bits = 0;
+
+            for (uint32_t x = start; x < end; x++)
+                bits |= static_cast<uint64_t>(in[x] > threshold) << (x - start);
+
+            out[word] = bits;
+        }
+    }
+}
+
+void kernels::apply_lut(const GConstImageView& src, const GImageView& dst, const GImage::LUT& lut)
+{
+    check_same_size(src, dst);
+
+    for (uint32_t y = 0; y < src.height; y++)
+    {
+        const unsigned char* in = src.row(y);
+        unsigned char* out = dst.row(y);
+
+        for (uint32_t x = 0; x < src.width; x++)
+            out[x] = lut[in[x]];
+    }
+}
+
+void kernels::gamma_correct(const GConstImageView& src, const GImageView& dst, double correction)
+{
+    kernels::apply_lut(src, dst, GImage::gamma_lut(correction));
+}
+
+GImage::Histogram kernels::histogram(const GConstImageView& src, uint32_t step)
+{
+    // Consecutive pixels go to different sub-histograms, so runs of the same level
+    // do not wait on the store of the previous increment
+    constexpr uint32_t ways = 8;
+    std::array<GImage::Histogram, ways> partial{};
+
+    step = std::max(step, 1u);
+
+    for (uint32_t y = 0; y < src.height; y += step)
+    {
+        const unsigned char* in = src.row(y);
+        uint32_t x = 0;
+
+        if (step == 1)
+        {
+            // Eight pixels per load, a histogram has no use for wider vectors as it cannot scatter
+            for (; x + 8 <= src.width; x += 8)
+            {
+                uint64_t px;
+                std::memcpy(&px, in + x, sizeof(px));
+
+                for (uint32_t i = 0; i < 8; i++)
+                    partial[i % ways][(px >> (i * 8)) & 0xFFu]++;
+            }
+        }
+
+        for (uint32_t i = 0; x < src.width; x += step, i++)
+            partial[i % ways][in[x]]++;
+    }
+
+    GImage::Histogram histogram{};
+
+    for (const auto& part : partial)
+    {
+        for (uint32_t i = 0; i < GImage::levels; i++)
+            histogram[i] += part[i];
+    }
+
+    // Bias towards lighter colors
+    histogram[0] = 0;
+
+    return histogram;
+}
+
+unsigned char kernels::otsu(const GConstImageView& src, uint32_t step)
+{
+    return GImage::otsu(kernels::histogram(src, step));
 }
\ No newline at end of file
@@ -7,17 +7,72 @@
 
 #include "util.h"
 
+#include <array>
 #include <filesystem>
 #include <string>
+#include <type_traits>
+#include <vector>
 
+#include <cstddef>
 #include <limits>
 
+// Non-owning, possibly strided view of an 8-bit grayscale bitmap
+template<typename T>
+struct GBasicImageView
+{
+    T* data = nullptr;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::size_t stride = 0;
+
+    [[nodiscard]] T* row(uint32_t y) const
+    {
+        return this->data + y * this->stride;
+    }
+
+    T& operator[](const uvec2& xy) const
+    {
+        return this->data[xy.x + xy.y * this->stride];
+    }
+
+    // Region of interest, shares the stride of the parent view
+    [[nodiscard]] GBasicImageView subview(uint32_t x, uint32_t y, uint32_t w, uint32_t h) const
+    {
+        return { this->data + x + y * this->stride, w, h, this->stride };
+    }
+
+    operator GBasicImageView<const T>() const requires (!std::is_const_v<T>)
+    {
+        return { this->data, this->width, this->height, this->stride };
+    }
+};
+
+typedef GBasicImageView<unsigned char> GImageView;
+typedef GBasicImageView<const unsigned char> GConstImageView;
+
+enum class DiffusionKernel
+{
+    FloydSteinberg,
+    Atkinson,
+    SierraLite,
+    Stucki
+};
+
+enum class OrderedPattern
+{
+    Bayer4,
+    Bayer8,
+    Bayer16,
+    BlueNoise
+};
+
 class GImage
 {
     public:
         static constexpr uint32_t MAX_SIZE = 16384;
         static constexpr uint32_t levels = std::numeric_limits<unsigned char>::max() + 1;
         typedef std::array<uint32_t, levels> Histogram;
+        typedef std::array<unsigned char, levels> LUT;
 
         explicit GImage(const std::filesystem::path &filename);
         GImage(uint32_t width, uint32_t height);
@@ -32,18 +87,30 @@ class GImage
         [[nodiscard]] uint32_t getHeight() const;
         unsigned char &operator[](const uvec2 &xy);
         [[nodiscard]] unsigned char operator[](const uvec2 &xy) const;
-        [[nodiscard]] Histogram getHistogram() const;
-        [[nodiscard]] unsigned char otsu() const;
+        // A step above 1 only samples every step-th pixel of every step-th row
+        [[nodiscard]] Histogram getHistogram(uint32_t step = 1) const;
+        [[nodiscard]] unsigned char otsu(uint32_t step = 1) const;
+        [[nodiscard]] static unsigned char otsu(const Histogram& histogram);
+        [[nodiscard]] static Histogram map_histogram(const Histogram& histogram, const LUT& lut);
+        [[nodiscard]] static LUT gamma_lut(double correction);
+        // Expands limited range (16-235) luma to the full 0-255 range
+        [[nodiscard]] static LUT limited_range_lut();
+        // Applies first, then second
+        [[nodiscard]] static LUT compose_lut(const LUT& first, const LUT& second);
         [[nodiscard]] GImage invert() const;
         GImage &invert_in_place();
         GImage &gamma_correct(double correction);
         [[nodiscard]] GImage resize_bilinear(uint32_t new_width, uint32_t new_height) const;
         void realloc_size(uint32_t new_width, uint32_t new_height);
-        [[nodiscard]] GImage dither(unsigned char threshold) const;
-        [[nodiscard]] GImage dither_ordered(unsigned char threshold) const;
+        // Floyd-Steinberg, threads > 1 diffuses rows in parallel as a wavefront, 0 uses all cores
+        [[nodiscard]] GImage dither(unsigned char threshold, uint32_t threads = 1) const;
+        [[nodiscard]] GImage dither(unsigned char threshold, DiffusionKernel kernel, bool serpentine = false) const;
+        [[nodiscard]] GImage dither_ordered(unsigned char threshold, OrderedPattern pattern = OrderedPattern::Bayer8) const;
         [[nodiscard]] GImage binary_threshold(unsigned char threshold) const;
         [[nodiscard]] unsigned char* data();
         [[nodiscard]] const unsigned char* data() const;
+        [[nodiscard]] GImageView view();
+        [[nodiscard]] GConstImageView view() const;
         ~GImage();
 
     private:
@@ -52,5 +119,68 @@ class GImage
         uint32_t height;
 };
 
+/*
+ * Packed 1 bit per pixel image for thresholded and dithered frames, an
+ * eighth of the size of the equivalent 0/255 GImage. Rows start on a 64-bit
+ * word, pixel x is bit x % 64 of word x / 64 of its row and set for a
+ * raised (white) pixel. Bits past the width are always clear.
+ */
+class GBitImage
+{
+    public:
+        GBitImage(uint32_t width, uint32_t height);
+        GBitImage();
+        // Raises every pixel that is not 0
+        explicit GBitImage(const GConstImageView& img);
+
+        [[nodiscard]] uint32_t getWidth() const;
+        [[nodiscard]] uint32_t getHeight() const;
+        [[nodiscard]] std::size_t getWordsPerRow() const;
+        [[nodiscard]] bool operator[](const uvec2 &xy) const;
+        void set(const uvec2 &xy, bool raised);
+        [[nodiscard]] uint64_t* row(uint32_t y);
+        [[nodiscard]] const uint64_t* row(uint32_t y) const;
+        // Clears the image when the size changes
+        void realloc_size(uint32_t new_width, uint32_t new_height);
+        // Resizes to img and raises every pixel that is not 0
+        void pack(const GConstImageView& img);
+        // Expands to 0 and 255, img must have the same size
+        void unpack(const GImageView& img) const;
+        [[nodiscard]] GImage to_image() const;
+
+        // Sets bit x of out for every pixel of in that is not 0, clears the rest up to the next word
+        static void pack_row(const unsigned char* in, uint64_t* out, uint32_t width);
+        [[nodiscard]] static std::size_t words_per_row(uint32_t width);
+
+    private:
+        std::vector<uint64_t> words;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        std::size_t wordsPerRow = 0;
+};
+
+
+/*
+ * The GImage operations on views, so they can run on sub-rectangles, decoder planes
+ * or caller owned memory without allocating. Unless resizing, the destination
+ * must have the same dimensions as the source and may be the same view.
+ */
+namespace kernels
+{
+    void resize_bilinear(const GConstImageView& src, const GImageView& dst);
+    void dither(const GConstImageView& src, const GImageView& dst, unsigned char threshold, uint32_t threads = 1);
+    void dither(const GConstImageView& src, const GImageView& dst, unsigned char threshold, DiffusionKernel kernel, bool serpentine = false);
+    void dither_ordered(const GConstImageView& src, const GImageView& dst, unsigned char threshold, OrderedPattern pattern = OrderedPattern::Bayer8);
+    void binary_threshold(const GConstImageView& src, const GImageView& dst, unsigned char threshold);
+    // The same straight to one bit per pixel, dst is resized to the source
+    void dither(const GConstImageView& src, GBitImage& dst, unsigned char threshold, uint32_t threads = 1);
+    void dither(const GConstImageView& src, GBitImage& dst, unsigned char threshold, DiffusionKernel kernel, bool serpentine = false);
+    void dither_ordered(const GConstImageView& src, GBitImage& dst, unsigned char threshold, OrderedPattern pattern = OrderedPattern::Bayer8);
+    void binary_threshold(const GConstImageView& src, GBitImage& dst, unsigned char threshold);
+    void apply_lut(const GConstImageView& src, const GImageView& dst, const GImage::LUT& lut);
+    void gamma_correct(const GConstImageView& src, const GImageView& dst, double correction);
+    [[nodiscard]] GImage::Histogram histogram(const GConstImageView& src, uint32_t step = 1);
+    [[nodiscard]] unsigned char otsu(const GConstImageView& src, uint32_t step = 1);
+}
 
 #endif //PNG2BR_IMAGE_H
@@ -0,0 +1,270 @@
+#include "incremental.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define INCREMENTAL_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    // Source pixels are compared in tiles of this size, in a single pass over the frame
+    constexpr uint32_t TILE_SIZE = 16;
+}
+
+IncrementalProcessor::IncrementalProcessor() = default;
+
+void IncrementalProcessor::setNoiseLevel(uint32_t level)
+{
+    this->noiseLevel = level;
+}
+
+void IncrementalProcessor::invalidate()
+{
+    this->valid = false;
+    this->outputValid = false;
+}
+
+void IncrementalProcessor::reset(const GConstImageView& luma, const GImage::LUT& lutIn, uint32_t width, uint32_t height)
+{
+    this->lut = lutIn;
+    this->resampler = BilinearResampler::cached(luma.width, luma.height, width, height);
+
+    this->reference.realloc_size(luma.width, luma.height);
+    this->mapped.realloc_size(luma.width, luma.height);
+    this->image.realloc_size(width, height);
+
+    for (uint32_t y = 0; y < luma.height; y++)
+        std::copy_n(luma.row(y), luma.width, this->reference.view().row(y));
+
+    kernels::apply_lut(this->reference.view(), this->mapped.view(), this->lut);
+    kernels::resize_bilinear(this->mapped.view(), this->image.view());
+
+    this->blocksX = (width + BLOCK_WIDTH - 1) / BLOCK_WIDTH;
+    this->blocksY = (height + BLOCK_HEIGHT - 1) / BLOCK_HEIGHT;
+    this->dirtyBlocks = this->blocksX * this->blocksY;
+
+    this->runs.clear();
+
+    for (uint32_t by = 0; by < this->blocksY; by++)
+        this->runs.push_back({ 0, by * BLOCK_HEIGHT, width, std::min((by + 1) * BLOCK_HEIGHT, height) });
+
+    this->everythingDirty = true;
+    this->valid = true;
+}
+
+void IncrementalProcessor::sourceRect(const Rect& rect, Rect& src) const
+{
+    src.x0 = this->resampler->getColumnTap(rect.x0).index0;
+    src.x1 = this->resampler->getColumnTap(rect.x1 - 1).index1 + 1;
+    src.y0 = this->resampler->getRowTap(rect.y0).index0;
+    src.y1 = this->resampler->getRowTap(rect.y1 - 1).index1 + 1;
+}
+
+void IncrementalProcessor::diffTiles(const GConstImageView& luma)
+{
+    const uint32_t tilesX = (luma.width + TILE_SIZE - 1) / TILE_SIZE;
+    const uint32_t tilesY = (luma.height + TILE_SIZE - 1) / TILE_SIZE;
+    const GConstImageView ref = this->reference.view();
+
+    this->tileSad.assign(static_cast<std::size_t>(tilesX) * tilesY, 0);
+
+    for (uint32_t y = 0; y < luma.height; y++)
+    {
+        const unsigned char* a = luma.row(y);
+        const unsigned char* b = ref.row(y);
+        uint64_t* sums = this->tileSad.data() + static_cast<std::size_t>(y / TILE_SIZE) * tilesX;
+        uint32_t x = 0;
+
+#if INCREMENTAL_SSE2
+        for (; x + TILE_SIZE <= luma.width; x += TILE_SIZE)
+        {
+            __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + x));
+            __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + x));
+            __m128i sad = _mm_sad_epu8(va, vb);
+            sums[x / TILE_SIZE] += static_cast<uint32_t>(_mm_cvtsi128_si32(sad) + _mm_cvtsi128_si32(_mm_srli_si128(sad, 8)));
+        }
+#endif
+
+        for (; x < luma.width; x++)
+            sums[x / TILE_SIZE] += std::abs(a[x] - b[x]);
+    }
+}
+
+uint32_t IncrementalProcessor::update(const GConstImageView& luma, const GImage::LUT& lutIn, uint32_t width, uint32_t height)
+{
+    if (!this->valid || luma.width != this->reference.getWidth() || luma.height != this->reference.getHeight() ||
+        width != this->image.getWidth() || height != this->image.getHeight() || lutIn != this->lut)
+    {
+        this->reset(luma, lutIn, width, height);
+        return this->dirtyBlocks;
+    }
+
+    if (width == 0 || height == 0 || luma.width == 0 || luma.height == 0)
+    {
+        this->dirtyBlocks = 0;
+        this->runs.clear();
+        this->everythingDirty = false;
+        return 0;
+    }
+
+    this->diffTiles(luma);
+
+    const uint32_t tilesX = (luma.width + TILE_SIZE - 1) / TILE_SIZE;
+
+    this->runs.clear();
+    this->dirtyBlocks = 0;
+
+    for (uint32_t by = 0; by < this->blocksY; by++)
+    {
+        const uint32_t y0 = by * BLOCK_HEIGHT;
+        const uint32_t y1 = std::min(y0 + BLOCK_HEIGHT, height);
+        bool extend = false;
+
+        for (uint32_t bx = 0; bx < this->blocksX; bx++)
+        {
+            Rect block{ bx * BLOCK_WIDTH, y0, std::min((bx + 1) * BLOCK_WIDTH, width), y1 };
+            Rect src{};
+            this->sourceRect(block, src);
+
+            // All tiles the source rectangle touches
+            uint64_t sad = 0;
+
+            for (uint32_t ty = src.y0 / TILE_SIZE; ty <= (src.y1 - 1) / TILE_SIZE; ty++)
+            {
+                for (uint32_t tx = src.x0 / TILE_SIZE; tx <= (src.x1 - 1) / TILE_SIZE; tx++)
+                    sad += this->tileSad[ty * tilesX + tx];
+            }
+
+            const uint64_t pixels = static_cast<uint64_t>(src.x1 - src.x0) * (src.y1 - src.y0);
+
+            if (sad <= pixels * this->noiseLevel)
+            {
+                extend = false;
+                continue;
+            }
+
+            this->dirtyBlocks++;
+
+            if (extend)
+                this->runs.back().x1 = block.x1;
+            else
+                this->runs.push_back(block);
+
+            extend = true;
+        }
+    }
+
+    // Source rectangles of neighbouring blocks overlap, so refresh all of them before resampling
+    for (const Rect& run : this->runs)
+    {
+        Rect src{};
+        this->sourceRect(run, src);
+
+        const GConstImageView lumaRect = luma.subview(src.x0, src.y0, src.x1 - src.x0, src.y1 - src.y0);
+        const GImageView referenceRect = this->reference.view().subview(src.x0, src.y0, src.x1 - src.x0, src.y1 - src.y0);
+
+        for (uint32_t y = 0; y < lumaRect.height; y++)
+            std::copy_n(lumaRect.row(y), lumaRect.width, referenceRect.row(y));
+
+        kernels::apply_lut(referenceRect, this->mapped.view().subview(src.x0, src.y0, src.x1 - src.x0, src.y1 - src.y0), this->lut);
+    }
+
+    const GConstImageView mappedView = this->mapped.view();
+    const GImageView imageView = this->image.view();
+
+    for (const Rect& run : this->runs)
+        this->resampler->resize(mappedView.data, mappedView.stride, imageView.data, imageView.stride, run.x0, run.y0, run.x1, run.y1);
+
+    this->everythingDirty = this->dirtyBlocks == this->blocksX * this->blocksY;
+
+    return this->dirtyBlocks;
+}
+
+bool IncrementalProcessor::ditherAll(unsigned char thresholdIn)
+{
+    bool all = !this->outputValid || this->everythingDirty || thresholdIn != this->threshold;
+
+    this->threshold = thresholdIn;
+    this->outputValid = true;
+
+    if (all)
+        this->output.realloc_size(this->image.getWidth(), this->image.getHeight());
+
+    return all;
+}
+
+void IncrementalProcessor::dither(ErrorDiffuser& diffuser, unsigned char thresholdIn)
+{
+    if (this->ditherAll(thresholdIn))
+    {
+        diffuser.diffuse(this->image.view(), this->output.view(), thresholdIn);
+        return;
+    }
+
+    const GConstImageView src = this->image.view();
+    const GImageView dst = this->output.view();
+
+    for (const Rect& run : this->runs)
+    {
+        // Error only flows right and down, or left with serpentine scanning, never up
+        const uint32_t x0 = run.x0 - std::min(run.x0, DIFFUSION_MARGIN);
+        const uint32_t y0 = run.y0 - std::min(run.y0, DIFFUSION_MARGIN);
+        const uint32_t x1 = std::min(run.x1 + DIFFUSION_MARGIN, src.width);
+        const uint32_t w = x1 - x0;
+        const uint32_t h = run.y1 - y0;
+
+        this->scratch.resize(static_cast<std::size_t>(w) * h);
+        const GImageView region{ this->scratch.data(), w, h, w };
+
+        diffuser.diffuse(src.subview(x0, y0, w, h), region, thresholdIn);
+
+        for (uint32_t y = run.y0; y < run.y1; y++)
+            std::copy(region.row(y - y0) + (run.x0 - x0), region.row(y - y0) + (run.x1 - x0), dst.row(y) + run.x0);
+    }
+}
+
+void IncrementalProcessor::dither(OrderedDitherer& ditherer, unsigned char thresholdIn)
+{
+    const bool all = this->ditherAll(thresholdIn);
+    const GConstImageView src = this->image.view();
+    const GImageView dst = this->output.view();
+
+    ditherer.begin(src.width, thresholdIn);
+
+    if (all)
+    {
+        for (uint32_t y = 0; y < src.height; y++)
+            ditherer.ditherRow(src.row(y), dst.row(y), y);
+
+        return;
+    }
+
+    for (const Rect& run : this->runs)
+    {
+        for (uint32_t y = run.y0; y < run.y1; y++)
+            ditherer.ditherRow(src.row(y), dst.row(y), y, run.x0, run.x1);
+    }
+}
+
+const GImage& IncrementalProcessor::getImage() const
+{
+    return this->image;
+}
+
+const GImage& IncrementalProcessor::getOutput() const
+{
+    return this->output;
+}
+
+uint32_t IncrementalProcessor::getBlockCount() const
+{
+    return this->blocksX * this->blocksY;
+}
+
+uint32_t IncrementalProcessor::getDirtyBlockCount() const
+{
+    return this->dirtyBlocks;
+}
\ No newline at end of file
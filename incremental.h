@@ -0,0 +1,100 @@
+#ifndef PNG2BR_INCREMENTAL_H
+#define PNG2BR_INCREMENTAL_H
+
+#include "dither.h"
+#include "image.h"
+#include "resampler.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/*
+ * Incremental frame processing for mostly static video, e.g. screen
+ * recordings or talking heads.
+ *
+ * The output frame is split into blocks of whole braille cells. A block is
+ * dirty when the source pixels it is resampled from differ from the ones it
+ * was last processed with by more than the noise level. The frame is
+ * compared in one pass of 16x16 tile sums of absolute differences (SSE2
+ * where available), a block looks at the tiles its source pixels touch. Only dirty blocks go through the LUT,
+ * the resampler and the ditherer again, clean blocks keep their dithered
+ * bits, so the renderer finds their cells unchanged. Small changes below the
+ * noise level accumulate until the block is refreshed.
+ *
+ * Ordered dithering of a block is exact. Error diffusion of a run of dirty
+ * blocks starts DIFFUSION_MARGIN pixels to the left, the right and above the
+ * run so the error flowing into it has settled, the error flowing out of
+ * it into clean blocks is dropped.
+ */
+class IncrementalProcessor
+{
+    public:
+        // 8 cells wide and 4 cells high
+        static constexpr uint32_t BLOCK_WIDTH = 16;
+        static constexpr uint32_t BLOCK_HEIGHT = 16;
+        static constexpr uint32_t DIFFUSION_MARGIN = 8;
+
+        IncrementalProcessor();
+
+        // Mean absolute difference per source pixel above which a block is reprocessed
+        void setNoiseLevel(uint32_t level);
+        // Reprocesses the whole frame next time, e.g. after changing the dithering method
+        void invalidate();
+
+        // Brings getImage() up to date with luma passed through lut and resized to width x height,
+        // returns the number of blocks that were reprocessed
+        uint32_t update(const GConstImageView& luma, const GImage::LUT& lut, uint32_t width, uint32_t height);
+
+        // Dithers the blocks reprocessed by the last update() into getOutput(),
+        // the whole frame if everything changed or the threshold is a different one
+        void dither(ErrorDiffuser& diffuser, unsigned char threshold);
+        void dither(OrderedDitherer& ditherer, unsigned char threshold);
+
+        // The LUT mapped and resized frame
+        [[nodiscard]] const GImage& getImage() const;
+        [[nodiscard]] const GImage& getOutput() const;
+        [[nodiscard]] uint32_t getBlockCount() const;
+        [[nodiscard]] uint32_t getDirtyBlockCount() const;
+
+    private:
+        // Pixel rectangle [x0, x1) x [y0, y1)
+        struct Rect
+        {
+            uint32_t x0;
+            uint32_t y0;
+            uint32_t x1;
+            uint32_t y1;
+        };
+
+        void reset(const GConstImageView& luma, const GImage::LUT& lut, uint32_t width, uint32_t height);
+        void sourceRect(const Rect& rect, Rect& src) const;
+        void diffTiles(const GConstImageView& luma);
+        [[nodiscard]] bool ditherAll(unsigned char threshold);
+
+        uint32_t noiseLevel = 2;
+        bool valid = false;
+        bool outputValid = false;
+        bool everythingDirty = true;
+        unsigned char threshold = 0;
+
+        GImage::LUT lut{};
+        std::shared_ptr<const BilinearResampler> resampler;
+
+        // Luma as of the last time each block was processed, and that through the LUT
+        GImage reference;
+        GImage mapped;
+        GImage image;
+        GImage output;
+
+        uint32_t blocksX = 0;
+        uint32_t blocksY = 0;
+        uint32_t dirtyBlocks = 0;
+        // Runs of horizontally adjacent dirty blocks in output pixels
+        std::vector<Rect> runs;
+        std::vector<unsigned char> scratch;
+        // Sum of absolute differences to the reference per source tile
+        std::vector<uint64_t> tileSad;
+};
+
+#endif //PNG2BR_INCREMENTAL_H
\ No newline at end of file
@@ -1,126 +1,347 @@
 #include <iostream>
 #include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <string>
+#include <vector>
 
 #ifdef _WIN32
 #include <windows.h>
 #include <fcntl.h>
 #endif
 
+#include "batch.h"
 #include "image.h"
 
-int main(int argc, char *argv[])
+struct Options
+{
+    // Files and directories, directories contribute the PNG files directly inside them
+    std::vector<std::filesystem::path> inputs;
+    // Files listing one input per line, - for stdin
+    std::vector<std::string> lists;
+    // Concatenated output, stdout if empty
+    std::filesystem::path output;
+    BatchConverter::Config config;
+};
+
+static void print_usage(const std::string& program)
+{
+    std::cerr << "Usage: " << program << " <filename>\n"
+              << "       " << program << " [options] <file|directory>...\n"
+              << "  A single file without options asks for the output size, anything else converts all files without asking\n"
+              << "  --width=N                 Output width in braille cells, up to 8192 (default 80)\n"
+              << "  --height=N                Output height in braille cells, half of them are shown, up to 4096, 0 keeps the aspect ratio (default 0)\n"
+              << "  --dither=threshold|floyd-steinberg|atkinson|sierra-lite|stucki|bayer4|bayer8|bayer16|blue-noise\n"
+              << "                            Plain threshold, error diffusion kernel or ordered dither pattern (default threshold)\n"
+              << "  --serpentine              Alternate the error diffusion scan direction every row\n"
+              << "  --threshold=N|otsu        Threshold level, otsu picks one per image (default otsu)\n"
+              << "  --list=FILE               Also convert the files listed in FILE one per line, - for stdin, may be repeated\n"
+              << "  --output=FILE             Write the images one after the other to FILE instead of stdout\n"
+              << "  --output-dir=DIR          Write each image to DIR/<name>.txt instead, names taken by an earlier input fail\n"
+              << "  --jobs=N                  Conversion threads, up to 1024, 0 for all cores (default 0)\n"
+              << "  --max-in-flight=N         Converted images waiting to be written in order, up to 65536, 0 for twice the jobs (default 0)\n";
+}
+
+// The resized image must stay within GImage::MAX_SIZE
+static constexpr uint32_t max_width = GImage::MAX_SIZE / BrailleEncoder::CELL_WIDTH;
+static constexpr uint32_t max_height = GImage::MAX_SIZE / BrailleEncoder::CELL_HEIGHT;
+static constexpr uint32_t max_jobs = 1024;
+static constexpr std::size_t max_in_flight = 65536;
+
+// Plain decimal numbers up to max only, std::stoul would wrap negative ones around
+template<typename T>
+static bool parse_number(const std::string& value, T max, T& result)
 {
-    if (argc != 2)
+    if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos)
+        return false;
+
+    const unsigned long long number = std::stoull(value);
+
+    if (number > max)
+        return false;
+
+    result = static_cast<T>(number);
+    return true;
+}
+
+static bool parse_args(const std::vector<std::string>& args, Options& options)
+{
+    BatchConverter::Settings& settings = options.config.settings;
+
+    for (const auto& arg : args)
     {
-        std::cerr << "Argument needed: filename." << std::endl;
-        return EXIT_FAILURE;
+        if (arg.rfind("--", 0) != 0)
+        {
+            options.inputs.emplace_back(arg);
+            continue;
+        }
+
+        auto eq = arg.find('=');
+        std::string name = arg.substr(2, eq == std::string::npos ? std::string::npos : eq - 2);
+        std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+
+        if (name == "width")
+        {
+            if (!parse_number(value, max_width, settings.width))
+                return false;
+        }
+        else if (name == "height")
+        {
+            if (!parse_number(value, max_height, settings.height))
+                return false;
+        }
+        else if (name == "dither")
+        {
+            settings.algorithm = BatchConverter::Algorithm::Diffusion;
+
+            if (value == "threshold")
+                settings.algorithm = BatchConverter::Algorithm::Threshold;
+            else if (value == "floyd-steinberg")
+                settings.kernel = DiffusionKernel::FloydSteinberg;
+            else if (value == "atkinson")
+                settings.kernel = DiffusionKernel::Atkinson;
+            else if (value == "sierra-lite")
+                settings.kernel = DiffusionKernel::SierraLite;
+            else if (value == "stucki")
+                settings.kernel = DiffusionKernel::Stucki;
+            else
+            {
+                settings.algorithm = BatchConverter::Algorithm::Ordered;
+
+                if (value == "bayer4")
+                    settings.pattern = OrderedPattern::Bayer4;
+                else if (value == "bayer8")
+                    settings.pattern = OrderedPattern::Bayer8;
+                else if (value == "bayer16")
+                    settings.pattern = OrderedPattern::Bayer16;
+                else if (value == "blue-noise")
+                    settings.pattern = OrderedPattern::BlueNoise;
+                else
+                    return false;
+            }
+        }
+        else if (name == "serpentine")
+            settings.serpentine = true;
+        else if (name == "threshold")
+        {
+            settings.fixedThreshold = value != "otsu";
+
+            if (settings.fixedThreshold && !parse_number<unsigned char>(value, UCHAR_MAX, settings.threshold))
+                return false;
+        }
+        else if (name == "list")
+            options.lists.push_back(value);
+        else if (name == "output")
+            options.output = value;
+        else if (name == "output-dir")
+            options.config.outputDirectory = value;
+        else if (name == "jobs")
+        {
+            if (!parse_number(value, max_jobs, options.config.jobs))
+                return false;
+        }
+        else if (name == "max-in-flight")
+        {
+            if (!parse_number(value, max_in_flight, options.config.maxInFlight))
+                return false;
+        }
+        else
+            return false;
     }
 
+    return settings.width && (!options.inputs.empty() || !options.lists.empty());
+}
 
-#ifdef _WIN32
-    std::cout << "This program doesn't work with CMD or PowerShell windows as they don't support unicode characters. 😡" << std::endl;
-    const unsigned int initial_cp = GetConsoleOutputCP();
-    SetConsoleOutputCP(CP_UTF8);
-    fflush(stdout);
-    _setmode(_fileno(stdout), _O_BINARY);
-#endif
+static void read_list(std::istream& in, std::vector<std::filesystem::path>& files)
+{
+    std::string line;
 
-    try
+    while (std::getline(in, line))
     {
-        std::filesystem::path file(argv[1]);
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+
+        if (!line.empty())
+            files.emplace_back(line);
+    }
+}
+
+// Directories are expanded to their PNG files in name order, anything else is kept for the converter to report
+static std::vector<std::filesystem::path> collect_files(const Options& options)
+{
+    std::vector<std::filesystem::path> inputs = options.inputs;
+    std::vector<std::filesystem::path> files;
 
-        if (!std::filesystem::is_regular_file(file))
+    for (const auto& list : options.lists)
+    {
+        if (list == "-")
         {
-            throw std::runtime_error(file.string() + " is not a valid file!");
+            read_list(std::cin, inputs);
+            continue;
         }
 
-        GImage img{file};
+        std::ifstream in(list);
 
-        std::cout << "Image file: " << file << std::endl;
-        std::cout << "  Width: " << img.getWidth() << std::endl;
-        std::cout << "  Height: " << img.getHeight() << std::endl;
+        if (!in)
+            throw std::runtime_error("Could not open the list " + list);
 
-        uint32_t resized_width = 0;
-        uint32_t resized_height = 0;
+        read_list(in, inputs);
+    }
 
-        do
+    for (const auto& input : inputs)
+    {
+        if (!std::filesystem::is_directory(input))
         {
-            if (!std::cin)
-            {
-                std::cin.clear();
-                std::cin.ignore();
-            }
-
-            std::cout << "  Resized width (enter a number): ";
-            std::cin >> resized_width;
+            files.push_back(input);
+            continue;
         }
-        while (!std::cin || resized_width == 0);
 
-        do
+        std::vector<std::filesystem::path> entries;
+
+        for (const auto& entry : std::filesystem::directory_iterator(input))
         {
-            if (!std::cin)
-            {
-                std::cin.clear();
-                std::cin.ignore();
-            }
+            std::string extension = entry.path().extension().string();
+            std::transform(extension.begin(), extension.end(), extension.begin(), [] (unsigned char c) { return std::tolower(c); });
 
-            std::cout << "  Resized height (enter a number): ";
-            std::cin >> resized_height;
+            if (entry.is_regular_file() && extension == ".png")
+                entries.push_back(entry.path());
         }
-        while (!std::cin || resized_height == 0);
 
-        constexpr uint32_t rescale_x = 2;
-        constexpr uint32_t rescale_y = 4;
+        std::sort(entries.begin(), entries.end());
+        files.insert(files.end(), entries.begin(), entries.end());
+    }
+
+    return files;
+}
+
+static int run_batch(const Options& options)
+{
+    const std::vector<std::filesystem::path> files = collect_files(options);
+    BatchConverter converter(options.config);
+    std::ofstream file;
+
+    if (!options.output.empty())
+    {
+        file.open(options.output, std::ios::binary);
+
+        if (!file)
+            throw std::runtime_error("Could not open " + options.output.string());
+    }
+
+    std::ostream& out = options.output.empty() ? std::cout : file;
+    const BatchConverter::Stats stats = converter.run(files, out, std::cerr);
+
+    if (!out)
+        throw std::runtime_error("Could not write the output");
 
-        GImage resized_copy = img.resize_bilinear(resized_width * rescale_x, resized_height * rescale_y);
-        unsigned char threshold = img.otsu();
-        GImage resized_img = resized_copy.binary_threshold(threshold);
+    std::cerr << "Converted " << stats.images << " images in " << std::fixed << std::setprecision(2) << stats.seconds << "s ("
+              << (stats.seconds > 0 ? stats.images / stats.seconds : 0.0) << " images/s) on " << converter.getConfig().jobs << " jobs, "
+              << stats.bytes << " bytes of output";
 
-        const auto& target = resized_img;
+    if (stats.failed)
+        std::cerr << ", " << stats.failed << " failed";
 
-        std::cout << "  Actual width: " << target.getWidth() << std::endl;
-        std::cout << "  Actual height: " << target.getHeight() << std::endl;
-        std::cout << "  Threshold: " << static_cast<unsigned int>(threshold) << std::endl;
+    std::cerr << std::endl;
 
-        constexpr int aspect0 = 12;
-        constexpr int aspect1 = 24;
+    return stats.failed || files.empty() ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static int run_interactive(const std::filesystem::path& file)
+{
+    if (!std::filesystem::is_regular_file(file))
+    {
+        throw std::runtime_error(file.string() + " is not a valid file!");
+    }
+
+    GImage img{file};
+
+    std::cout << "Image file: " << file << std::endl;
+    std::cout << "  Width: " << img.getWidth() << std::endl;
+    std::cout << "  Height: " << img.getHeight() << std::endl;
 
-        for (uint32_t y = 0; y < target.getHeight() / rescale_y * aspect0 / aspect1; y++)
+    BatchConverter::Settings settings;
+
+    do
+    {
+        if (!std::cin)
         {
-            uint32_t by = y * aspect1 / aspect0 * rescale_y;
+            std::cin.clear();
+            std::cin.ignore();
+        }
 
-            for (uint32_t x = 0; x < target.getWidth() / rescale_x; x++)
-            {
-                uint32_t bx = x * rescale_x;
+        std::cout << "  Resized width (enter a number): ";
+        std::cin >> settings.width;
+    }
+    while (!std::cin || settings.width == 0 || settings.width > max_width);
 
-                uint32_t pattern = 0;
+    do
+    {
+        if (!std::cin)
+        {
+            std::cin.clear();
+            std::cin.ignore();
+        }
 
-                pattern += 0x01u & target[{bx, by}];
-                pattern += 0x02u & target[{bx, by + 1}];
-                pattern += 0x04u & target[{bx, by + 2}];
-                pattern += 0x08u & target[{bx + 1, by}];
-                pattern += 0x10u & target[{bx + 1, by + 1}];
-                pattern += 0x20u & target[{bx + 1, by + 2}];
-                pattern += 0x40u & target[{bx, by + 3}];
-                pattern += 0x80u & target[{bx + 1, by + 3}];
+        std::cout << "  Resized height (enter a number): ";
+        std::cin >> settings.height;
+    }
+    while (!std::cin || settings.height == 0 || settings.height > max_height);
 
-                if (pattern == 0)
-                    pattern = 1;
+    BatchConverter::Result result;
+    BatchConverter::convert(img, settings, result);
 
-                pattern |= 0x2800u;
+    std::cout << "  Actual width: " << result.width << std::endl;
+    std::cout << "  Actual height: " << result.height << std::endl;
+    std::cout << "  Threshold: " << static_cast<unsigned int>(result.threshold) << std::endl;
 
-                // Some UTF-8 magic
-                char c[4] = { 0 };
-                c[0] = static_cast<char>((pattern >> 12u) + 0xE0u);
-                c[1] = static_cast<char>(((pattern >> 6u) & 0x3Fu) + 0x80u);
-                c[2] = static_cast<char>((pattern & 0x3Fu) + 0x80u);
+    std::cout.write(result.text.data(), static_cast<std::streamsize>(result.text.size()));
+    std::cout << std::flush;
 
-                std::cout << c;
-            }
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+    std::string program = argv[0];
+    std::vector<std::string> args(argv + 1, argv + argc);
 
-            std::cout << std::endl;
+    // A single file without options keeps the interactive mode
+    const bool interactive = args.size() == 1 && args[0].rfind("--", 0) != 0 && !std::filesystem::is_directory(args[0]);
+    Options options;
+
+    try
+    {
+        if (!interactive && !parse_args(args, options))
+        {
+            print_usage(program);
+            return EXIT_FAILURE;
         }
     }
+    catch (std::logic_error& e)
+    {
+        print_usage(program);
+        return EXIT_FAILURE;
+    }
+
+#ifdef _WIN32
+    if (interactive)
+        std::cout << "This program doesn't work with CMD or PowerShell windows as they don't support unicode characters. 😡" << std::endl;
+
+    const unsigned int initial_cp = GetConsoleOutputCP();
+    SetConsoleOutputCP(CP_UTF8);
+    fflush(stdout);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+    int status = EXIT_FAILURE;
+
+    try
+    {
+        status = interactive ? run_interactive(args[0]) : run_batch(options);
+    }
     catch (std::exception &e)
     {
         std::cerr << e.what() << std::endl;
@@ -130,5 +351,5 @@ int main(int argc, char *argv[])
     SetConsoleOutputCP(initial_cp);
 #endif
 
-    return 0;
+    return status;
 }
@@ -0,0 +1,192 @@
+#include "output.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+OutputWriter::OutputWriter(std::vector<std::unique_ptr<OutputSink>> sinksIn, std::size_t bufferCount) : sinks(std::move(sinksIn)), buffers(std::max<std::size_t>(bufferCount, 2))
+{
+    for (OutputFrame& buffer : this->buffers)
+        this->freeBuffers.push_back(&buffer);
+
+    this->thread = std::thread([this] { this->run(); });
+}
+
+OutputWriter::~OutputWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+
+    this->workAvailable.notify_one();
+    this->thread.join();
+}
+
+void OutputWriter::setBackpressureHandler(BackpressureHandler handler)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->backpressureHandler = std::move(handler);
+}
+
+std::string& OutputWriter::acquire()
+{
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    if (this->filling)
+        return this->filling->data;
+
+    auto available = [this] { return this->error || !this->freeBuffers.empty(); };
+
+    if (!available())
+    {
+        this->stats.bufferWaits++;
+        this->bufferFree.wait(lock, available);
+    }
+
+    if (this->error)
+        std::rethrow_exception(this->error);
+
+    this->filling = this->freeBuffers.back();
+    this->freeBuffers.pop_back();
+    this->filling->data.clear();
+
+    return this->filling->data;
+}
+
+void OutputWriter::submit(double timestamp, bool keyframe)
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+
+        if (this->error)
+            std::rethrow_exception(this->error);
+
+        if (!this->filling)
+            throw std::logic_error("No output buffer acquired");
+
+        this->filling->timestamp = timestamp;
+        this->filling->keyframe = keyframe;
+        this->queued.push_back(this->filling);
+        this->filling = nullptr;
+        this->updateBackpressure();
+    }
+
+    this->workAvailable.notify_one();
+}
+
+void OutputWriter::flush()
+{
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    this->bufferFree.wait(lock, [this] { return this->error || (this->queued.empty() && !this->writing); });
+
+    if (this->error)
+        std::rethrow_exception(this->error);
+}
+
+bool OutputWriter::takeKeyframeRequest()
+{
+    return this->keyframeRequested.exchange(false, std::memory_order_relaxed);
+}
+
+bool OutputWriter::isBackedUp() const
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->backedUp;
+}
+
+std::size_t OutputWriter::getBufferCount() const
+{
+    return this->buffers.size();
+}
+
+OutputWriter::Stats OutputWriter::getStats() const
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->stats;
+}
+
+void OutputWriter::run()
+{
+    std::vector<OutputFrame*> batch;
+    std::vector<const OutputFrame*> frames;
+
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+
+            this->workAvailable.wait(lock, [this] { return this->stopping || !this->queued.empty(); });
+
+            // Whatever was submitted before stopping is still written
+            if (this->queued.empty())
+                return;
+
+            batch.assign(this->queued.begin(), this->queued.end());
+            this->queued.clear();
+            this->writing = batch.size();
+        }
+
+        frames.assign(batch.begin(), batch.end());
+
+        const auto start = Clock::now();
+        std::exception_ptr e;
+
+        try
+        {
+            for (const std::unique_ptr<OutputSink>& sink : this->sinks)
+            {
+                sink->write(frames);
+
+                if (sink->takeKeyframeRequest())
+                    this->keyframeRequested.store(true, std::memory_order_relaxed);
+            }
+        }
+        catch (...)
+        {
+            e = std::current_exception();
+        }
+
+        const Clock::duration blocked = Clock::now() - start;
+
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+
+            this->stats.frames += batch.size();
+            this->stats.batches++;
+            this->stats.blockedTime += blocked;
+            this->stats.maxBlocked = std::max(this->stats.maxBlocked, blocked);
+
+            for (OutputFrame* buffer : batch)
+            {
+                this->stats.bytes += buffer->data.size();
+                this->freeBuffers.push_back(buffer);
+            }
+
+            this->writing = 0;
+            this->error = e;
+            this->updateBackpressure();
+        }
+
+        this->bufferFree.notify_all();
+
+        if (e)
+            return;
+    }
+}
+
+void OutputWriter::updateBackpressure()
+{
+    const bool now = this->freeBuffers.empty();
+
+    if (now == this->backedUp)
+        return;
+
+    this->backedUp = now;
+
+    if (now)
+        this->stats.backedUp++;
+
+    if (this->backpressureHandler)
+        this->backpressureHandler(now);
+}
\ No newline at end of file
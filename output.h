@@ -0,0 +1,110 @@
+#ifndef PNG2BR_OUTPUT_H
+#define PNG2BR_OUTPUT_H
+
+#include "sink.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Writes frames to a set of sinks on a thread of its own, so a slow
+ * terminal does not hold up the display loop.
+ *
+ * A small fixed set of byte buffers is reused: the producer fills the one
+ * returned by acquire() and queues it with submit(), the writer thread
+ * hands everything queued to each sink at once and gives the buffers back.
+ * Once no buffer is left for the next frame the output is backed up, which
+ * is reported to the backpressure handler so frames can be dropped instead
+ * of the producer blocking in acquire().
+ *
+ * The time spent in the sinks is measured, which is how long the terminal
+ * (or whatever else is slowest) kept the writer blocked.
+ */
+class OutputWriter
+{
+    public:
+        typedef std::chrono::steady_clock Clock;
+
+        struct Stats
+        {
+            uint64_t frames = 0;
+            // Times the sinks were called, with one or more frames
+            uint64_t batches = 0;
+            uint64_t bytes = 0;
+            // Time spent in the sinks, in total and for the longest batch of frames
+            Clock::duration blockedTime{ 0 };
+            Clock::duration maxBlocked{ 0 };
+            // Times the producer had to wait for a free buffer and times the output became backed up
+            uint64_t bufferWaits = 0;
+            uint64_t backedUp = 0;
+        };
+
+        // Called on the producer or the writer thread whenever the output becomes backed up or catches up again,
+        // with the writer's lock held
+        typedef std::function<void(bool backedUp)> BackpressureHandler;
+
+        // At least two buffers are used
+        explicit OutputWriter(std::vector<std::unique_ptr<OutputSink>> sinksIn, std::size_t bufferCount = 3);
+
+        OutputWriter(const OutputWriter&) = delete;
+        OutputWriter& operator=(const OutputWriter&) = delete;
+
+        // Writes what is queued before returning
+        ~OutputWriter();
+
+        void setBackpressureHandler(BackpressureHandler handler);
+
+        // Producer: an empty buffer to fill, waits if all of them are queued or being written.
+        // Rethrows the error of a failed write
+        std::string& acquire();
+        // Producer: queues the buffer returned by acquire()
+        void submit(double timestamp, bool keyframe);
+        // Waits until everything submitted is written
+        void flush();
+
+        // True once after a sink asked for a keyframe, the next frame should be a full redraw
+        bool takeKeyframeRequest();
+
+        [[nodiscard]] bool isBackedUp() const;
+        [[nodiscard]] std::size_t getBufferCount() const;
+        [[nodiscard]] Stats getStats() const;
+
+    private:
+        void run();
+        void updateBackpressure();
+
+        std::vector<std::unique_ptr<OutputSink>> sinks;
+
+        // Never resized, the queues point into it
+        std::vector<OutputFrame> buffers;
+        std::vector<OutputFrame*> freeBuffers;
+        std::deque<OutputFrame*> queued;
+        OutputFrame* filling = nullptr;
+        std::size_t writing = 0;
+
+        mutable std::mutex mutex;
+        std::condition_variable bufferFree;
+        std::condition_variable workAvailable;
+
+        BackpressureHandler backpressureHandler;
+        bool backedUp = false;
+        std::atomic<bool> keyframeRequested{ false };
+        bool stopping = false;
+        std::exception_ptr error;
+        Stats stats;
+
+        std::thread thread;
+};
+
+#endif //PNG2BR_OUTPUT_H
\ No newline at end of file
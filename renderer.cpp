@@ -0,0 +1,445 @@
+#include "renderer.h"
+
+#include <algorithm>
+#include <bit>
+#include <climits>
+#include <cstdlib>
+
+namespace
+{
+    // Unchanged cells between two changed ones are re-sent rather than skipped with
+    // a cursor escape when the gap is at most this wide
+    constexpr uint32_t MERGE_GAP = 3;
+
+    std::size_t decimalDigits(uint32_t value)
+    {
+        std::size_t digits = 1;
+
+        while (value >= 10)
+        {
+            value /= 10;
+            digits++;
+        }
+
+        return digits;
+    }
+
+    void appendDecimal(std::string& out, uint32_t value)
+    {
+        char buf[10];
+        char* end = buf + sizeof(buf);
+        char* ptr = end;
+
+        do
+        {
+            *--ptr = static_cast<char>('0' + value % 10);
+            value /= 10;
+        }
+        while (value);
+
+        out.append(ptr, end);
+    }
+}
+
+std::size_t TerminalRenderer::FrameStats::saved() const
+{
+    return this->fullBytes > this->bytes ? this->fullBytes - this->bytes : 0;
+}
+
+TerminalRenderer::TerminalRenderer(uint32_t originRowIn, uint32_t originColumnIn, bool blankAsDot) :
+        encoder(blankAsDot), originRow(originRowIn), originColumn(originColumnIn)
+{
+    this->buildPalette();
+}
+
+void TerminalRenderer::setColorMode(ColorMode mode)
+{
+    this->colorMode = mode;
+    this->buildPalette();
+}
+
+void TerminalRenderer::setColorLevels(uint32_t levels)
+{
+    this->colorLevels = std::clamp(levels, 2u, GImage::levels);
+    this->buildPalette();
+}
+
+void TerminalRenderer::setColorTolerance(uint32_t newTolerance)
+{
+    this->baseTolerance = std::min(newTolerance, static_cast<uint32_t>(UCHAR_MAX));
+    this->tolerance = this->baseTolerance;
+}
+
+void TerminalRenderer::setFrameByteBudget(std::size_t bytes)
+{
+    this->frameByteBudget = bytes;
+    this->tolerance = this->baseTolerance;
+}
+
+void TerminalRenderer::buildPalette()
+{
+    this->palette.clear();
+    this->color = this->colorMode != ColorMode::Mono;
+
+    auto escape = [] (const char* prefix, uint32_t a, const char* suffix) -> std::string {
+        std::string str = prefix;
+        appendDecimal(str, a);
+        str += suffix;
+        return str;
+    };
+
+    switch (this->colorMode)
+    {
+        case ColorMode::TrueColor:
+        {
+            // Evenly spread from black to white
+            for (uint32_t i = 0; i < this->colorLevels; i++)
+            {
+                uint32_t value = i * (GImage::levels - 1) / (this->colorLevels - 1);
+                std::string str = escape("\033[38;2;", value, ";");
+                appendDecimal(str, value);
+                str += ';';
+                appendDecimal(str, value);
+                str += 'm';
+                this->palette.push_back({ static_cast<unsigned char>(value), std::move(str) });
+            }
+
+            break;
+        }
+
+        case ColorMode::Xterm256:
+        {
+            // The 24 step gray ramp and the gray diagonal of the 6x6x6 cube
+            constexpr unsigned char cubeLevels[] = { 0, 95, 135, 175, 215, 255 };
+
+            for (uint32_t i = 0; i < 6; i++)
+                this->palette.push_back({ cubeLevels[i], escape("\033[38;5;", 16 + i * 43, "m") });
+
+            for (uint32_t i = 0; i < 24; i++)
+                this->palette.push_back({ static_cast<unsigned char>(8 + i * 10), escape("\033[38;5;", 232 + i, "m") });
+
+            break;
+        }
+
+        case ColorMode::Ansi16:
+            this->palette.push_back({ 0, "\033[30m" });
+            this->palette.push_back({ 127, "\033[90m" });
+            this->palette.push_back({ 229, "\033[37m" });
+            this->palette.push_back({ 255, "\033[97m" });
+            break;
+
+        case ColorMode::Mono:
+            this->palette.push_back({ 0, "" });
+            break;
+    }
+
+    std::stable_sort(this->palette.begin(), this->palette.end(), [] (const PaletteEntry& a, const PaletteEntry& b) {
+        return a.value < b.value;
+    });
+
+    for (uint32_t v = 0; v < GImage::levels; v++)
+    {
+        uint32_t best = 0;
+
+        for (uint32_t i = 1; i < this->palette.size(); i++)
+        {
+            if (std::abs(static_cast<int>(this->palette[i].value) - static_cast<int>(v)) < std::abs(static_cast<int>(this->palette[best].value) - static_cast<int>(v)))
+                best = i;
+        }
+
+        this->nearestEntry[v] = static_cast<unsigned char>(best);
+    }
+
+    uint16_t entry = 0;
+
+    for (uint32_t v = 0; v <= GImage::levels; v++)
+    {
+        while (entry < this->palette.size() && this->palette[entry].value < v)
+            entry++;
+
+        this->firstEntryFrom[v] = entry;
+    }
+
+    this->invalidate();
+}
+
+void TerminalRenderer::setBraille(bool enabled)
+{
+    this->braille = enabled;
+    this->invalidate();
+}
+
+void TerminalRenderer::invalidate()
+{
+    this->valid = false;
+}
+
+const TerminalRenderer::FrameStats& TerminalRenderer::getStats() const
+{
+    return this->stats;
+}
+
+void TerminalRenderer::buildCells(const unsigned char* cells, uint32_t newColumns, uint32_t newRows)
+{
+    if (newColumns != this->columns || newRows != this->rows)
+    {
+        this->columns = newColumns;
+        this->rows = newRows;
+        this->valid = false;
+    }
+
+    this->current.resize(static_cast<std::size_t>(this->columns) * this->rows);
+
+    for (std::size_t i = 0; i < this->current.size(); i++)
+    {
+        // The frame is dithered to 0 and 255, so the average only depends on the number of raised dots
+        auto avgVal = static_cast<uint32_t>(std::popcount(cells[i]) * UCHAR_MAX / 8.0);
+
+        this->current[i] = { cells[i], this->nearestEntry[avgVal] };
+    }
+
+    if (this->color && this->tolerance > 0)
+        this->mergeColorRuns();
+}
+
+void TerminalRenderer::mergeColorRuns()
+{
+    // Greedy in output order, a run ends once no palette entry is within the tolerance of all its cells
+    const int tol = static_cast<int>(this->tolerance);
+    const std::size_t count = this->current.size();
+    std::size_t start = 0;
+
+    auto finishRun = [&] (std::size_t end, int lo, int hi) -> void {
+        // Shortest escape in range, ties go to the entry closest to the middle
+        uint32_t best = this->firstEntryFrom[lo];
+        int mid = (lo + hi) / 2;
+
+        for (uint32_t i = best + 1; i < this->palette.size() && this->palette[i].value <= hi; i++)
+        {
+            std::size_t len = this->palette[i].escape.size();
+            std::size_t bestLen = this->palette[best].escape.size();
+
+            if (len < bestLen || (len == bestLen && std::abs(this->palette[i].value - mid) < std::abs(this->palette[best].value - mid)))
+                best = i;
+        }
+
+        for (std::size_t i = start; i < end; i++)
+            this->current[i].color = static_cast<unsigned char>(best);
+    };
+
+    while (start < count)
+    {
+        int value = this->palette[this->current[start].color].value;
+        int lo = std::max(value - tol, 0);
+        int hi = std::min(value + tol, static_cast<int>(UCHAR_MAX));
+        std::size_t end = start + 1;
+
+        for (; end < count; end++)
+        {
+            int next = this->palette[this->current[end].color].value;
+            int newLo = std::max(lo, next - tol);
+            int newHi = std::min(hi, next + tol);
+
+            uint16_t entry = newLo <= newHi ? this->firstEntryFrom[newLo] : this->palette.size();
+
+            if (entry >= this->palette.size() || this->palette[entry].value > newHi)
+                break;
+
+            lo = newLo;
+            hi = newHi;
+        }
+
+        finishRun(end, lo, hi);
+        start = end;
+    }
+}
+
+void TerminalRenderer::adaptTolerance()
+{
+    if (this->frameByteBudget == 0 || !this->color)
+        return;
+
+    if (this->stats.bytes > this->frameByteBudget)
+        this->tolerance = std::min(this->tolerance * 2 + 1, static_cast<uint32_t>(UCHAR_MAX));
+    else if (this->stats.bytes < this->frameByteBudget / 2 && this->tolerance > this->baseTolerance)
+        this->tolerance--;
+}
+
+void TerminalRenderer::appendGlyph(std::string& out, const Cell& cell) const
+{
+    if (this->braille)
+        out.append(this->encoder.glyph(cell.glyph), BrailleEncoder::GLYPH_BYTES);
+    else if (this->color)
+        out += '@';
+    else
+        out += std::popcount(cell.glyph) > 4 ? '@' : ' ';
+}
+
+std::size_t TerminalRenderer::colorBytes(unsigned char entry) const
+{
+    return this->palette[entry].escape.size();
+}
+
+void TerminalRenderer::appendColor(std::string& out, unsigned char entry)
+{
+    if (!this->color || this->terminalColor == entry)
+        return;
+
+    out += this->palette[entry].escape;
+
+    this->terminalColor = entry;
+    this->stats.colorChanges++;
+}
+
+void TerminalRenderer::appendCursor(std::string& out, uint32_t row, uint32_t column) const
+{
+    out += "\033[";
+    appendDecimal(out, row);
+    out += ';';
+    appendDecimal(out, column);
+    out += 'H';
+}
+
+std::size_t TerminalRenderer::fullSize() const
+{
+    const std::size_t glyphBytes = this->braille ? BrailleEncoder::GLYPH_BYTES : 1;
+    std::size_t size = 4 + decimalDigits(this->originRow) + decimalDigits(this->originColumn);
+    int seqColor = COLOR_UNKNOWN;
+
+    for (uint32_t r = 0; r < this->rows; r++)
+    {
+        if (r > 0)
+            size += this->originColumn == 1 ? 1 : 4 + decimalDigits(this->originRow + r) + decimalDigits(this->originColumn);
+
+        const Cell* row = this->current.data() + static_cast<std::size_t>(r) * this->columns;
+
+        for (uint32_t c = 0; c < this->columns; c++)
+        {
+            if (this->color && seqColor != row[c].color)
+            {
+                size += this->colorBytes(row[c].color);
+                seqColor = row[c].color;
+            }
+
+            size += glyphBytes;
+        }
+    }
+
+    return size;
+}
+
+void TerminalRenderer::renderFull(std::string& out)
+{
+    this->terminalColor = COLOR_UNKNOWN;
+    this->stats.colorChanges = 0;
+    this->stats.fullRedraw = true;
+    this->stats.changedCells = this->columns * this->rows;
+
+    this->appendCursor(out, this->originRow, this->originColumn);
+
+    for (uint32_t r = 0; r < this->rows; r++)
+    {
+        if (r > 0)
+        {
+            if (this->originColumn == 1)
+                out += '\n';
+            else
+                this->appendCursor(out, this->originRow + r, this->originColumn);
+        }
+
+        const Cell* row = this->current.data() + static_cast<std::size_t>(r) * this->columns;
+
+        for (uint32_t c = 0; c < this->columns; c++)
+        {
+            this->appendColor(out, row[c].color);
+            this->appendGlyph(out, row[c]);
+        }
+    }
+}
+
+void TerminalRenderer::renderDelta(std::string& out)
+{
+    this->terminalColor = COLOR_UNKNOWN;
+
+    for (uint32_t r = 0; r < this->rows; r++)
+    {
+        const Cell* row = this->current.data() + static_cast<std::size_t>(r) * this->columns;
+        const Cell* prevRow = this->previous.data() + static_cast<std::size_t>(r) * this->columns;
+
+        uint32_t c = 0;
+
+        while (c < this->columns)
+        {
+            if (row[c] == prevRow[c])
+            {
+                c++;
+                continue;
+            }
+
+            uint32_t start = c;
+            uint32_t end = c + 1;
+
+            for (uint32_t probe = end; probe < this->columns && probe - end < MERGE_GAP; probe++)
+            {
+                if (!(row[probe] == prevRow[probe]))
+                    end = probe + 1;
+            }
+
+            this->appendCursor(out, this->originRow + r, this->originColumn + start);
+
+            for (uint32_t i = start; i < end; i++)
+            {
+                this->stats.changedCells += !(row[i] == prevRow[i]);
+                this->appendColor(out, row[i].color);
+                this->appendGlyph(out, row[i]);
+            }
+
+            c = end;
+        }
+    }
+}
+
+const TerminalRenderer::FrameStats& TerminalRenderer::render(const GConstImageView& img, std::string& out)
+{
+    const uint32_t newColumns = BrailleEncoder::cellsPerRow(img.width);
+    const uint32_t newRows = BrailleEncoder::cellRows(img.height);
+
+    this->codes.resize(static_cast<std::size_t>(newColumns) * newRows);
+    BrailleEncoder::encodeImage(img, this->codes.data());
+
+    return this->render(this->codes.data(), newColumns, newRows, out);
+}
+
+const TerminalRenderer::FrameStats& TerminalRenderer::render(const unsigned char* cells, uint32_t columns, uint32_t rows, std::string& out)
+{
+    this->stats = {};
+    this->buildCells(cells, columns, rows);
+    this->stats.fullBytes = this->fullSize();
+
+    const std::size_t start = out.size();
+
+    if (this->valid)
+    {
+        this->renderDelta(out);
+
+        // Not worth it, e.g. a scene cut the caller did not report
+        if (out.size() - start >= this->stats.fullBytes)
+        {
+            out.resize(start);
+            this->renderFull(out);
+        }
+    }
+    else
+    {
+        this->renderFull(out);
+    }
+
+    this->stats.bytes = out.size() - start;
+
+    std::swap(this->current, this->previous);
+    this->valid = true;
+
+    this->adaptTolerance();
+
+    return this->stats;
+}
\ No newline at end of file
@@ -0,0 +1,126 @@
+#ifndef PNG2BR_RENDERER_H
+#define PNG2BR_RENDERER_H
+
+#include "braille.h"
+#include "image.h"
+
+#include <array>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/*
+ * Turns dithered frames into terminal output. The cell grid (glyph and
+ * colour) of the previous frame is kept, so only the spans of cells that
+ * changed are emitted, each preceded by a cursor positioning escape.
+ * A full redraw is done after invalidate() (e.g. on scene cuts), on size
+ * changes or whenever the delta would not be smaller than a full frame.
+ *
+ * Cell colours are quantised to the palette of the colour mode, then runs
+ * of cells are merged as long as one palette colour stays within the error
+ * budget of every cell in the run, picking the colour with the shortest
+ * escape sequence. An optional per-frame byte budget widens the error
+ * budget while frames are too large and narrows it back afterwards.
+ */
+class TerminalRenderer
+{
+    public:
+        enum class ColorMode
+        {
+            TrueColor,
+            Xterm256,
+            Ansi16,
+            Mono
+        };
+
+        struct FrameStats
+        {
+            std::size_t bytes = 0;
+            // What a full redraw of this frame would have taken
+            std::size_t fullBytes = 0;
+            uint32_t changedCells = 0;
+            uint32_t colorChanges = 0;
+            bool fullRedraw = false;
+
+            [[nodiscard]] std::size_t saved() const;
+        };
+
+        // The frame is drawn with its top left cell at the given 1-based terminal position
+        TerminalRenderer(uint32_t originRow, uint32_t originColumn, bool blankAsDot = false);
+
+        void setColorMode(ColorMode mode);
+        // Number of gray levels in TrueColor mode, 2-256
+        void setColorLevels(uint32_t levels);
+        // Maximum deviation in gray levels a cell may get to extend a colour run
+        void setColorTolerance(uint32_t tolerance);
+        // Adapts the tolerance to keep frames below the given size, 0 disables
+        void setFrameByteBudget(std::size_t bytes);
+        void setBraille(bool enabled);
+        // Forces the next frame to be a full redraw
+        void invalidate();
+
+        // Appends the escape sequences and glyphs updating the terminal to img
+        const FrameStats& render(const GConstImageView& img, std::string& out);
+        // Same for cells packed beforehand with BrailleEncoder::encodeImage(), e.g. on a worker thread
+        const FrameStats& render(const unsigned char* cells, uint32_t columns, uint32_t rows, std::string& out);
+        [[nodiscard]] const FrameStats& getStats() const;
+
+    private:
+        struct Cell
+        {
+            unsigned char glyph;
+            unsigned char color;
+
+            bool operator==(const Cell& other) const = default;
+        };
+
+        struct PaletteEntry
+        {
+            unsigned char value;
+            std::string escape;
+        };
+
+        static constexpr int COLOR_UNKNOWN = -1;
+
+        void buildPalette();
+        void mergeColorRuns();
+        void adaptTolerance();
+        void buildCells(const unsigned char* cells, uint32_t newColumns, uint32_t newRows);
+        void appendGlyph(std::string& out, const Cell& cell) const;
+        void appendColor(std::string& out, unsigned char color);
+        [[nodiscard]] std::size_t colorBytes(unsigned char color) const;
+        void appendCursor(std::string& out, uint32_t row, uint32_t column) const;
+        [[nodiscard]] std::size_t fullSize() const;
+        void renderFull(std::string& out);
+        void renderDelta(std::string& out);
+
+        BrailleEncoder encoder;
+        uint32_t originRow;
+        uint32_t originColumn;
+        ColorMode colorMode = ColorMode::TrueColor;
+        uint32_t colorLevels = 32;
+        uint32_t baseTolerance = 0;
+        uint32_t tolerance = 0;
+        std::size_t frameByteBudget = 0;
+        bool color = true;
+        bool braille = true;
+
+        // Sorted by value, cells store indices into it
+        std::vector<PaletteEntry> palette;
+        std::array<unsigned char, GImage::levels> nearestEntry{};
+        // Index of the first entry with a value >= the index, palette.size() if none
+        std::array<uint16_t, GImage::levels + 1> firstEntryFrom{};
+
+        bool valid = false;
+
+        uint32_t columns = 0;
+        uint32_t rows = 0;
+        std::vector<unsigned char> codes;
+        std::vector<Cell> current;
+        std::vector<Cell> previous;
+
+        int terminalColor = COLOR_UNKNOWN;
+        FrameStats stats;
+};
+
+#endif //PNG2BR_RENDERER_H
\ No newline at end of file
@@ -0,0 +1,87 @@
+#ifndef PNG2BR_REORDERWINDOW_H
+#define PNG2BR_REORDERWINDOW_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * Lets producers complete numbered items in any order while the consumer
+ * takes them in number order, with at most size() items between the oldest
+ * one not consumed yet and the newest one started. That bound is what keeps
+ * the memory of a parallel stage fixed however uneven the items are.
+ *
+ * Item i lives in slot i % size() from admits(i) until the consumer pops it.
+ * Nothing is synchronised: callers guard admits(), complete(), ready() and
+ * pop() with their own lock. A producer may fill at(i) without the lock
+ * before complete(i), and the consumer may read front() without it between
+ * ready() and pop(), as no one else touches the slot in between.
+ */
+template<typename T>
+class ReorderWindow
+{
+    public:
+        explicit ReorderWindow(std::size_t sizeIn = 1) : slots(std::max<std::size_t>(sizeIn, 1))
+        {
+
+        }
+
+        // Whether a producer may start on the item without running too far ahead of the consumer
+        [[nodiscard]] bool admits(uint64_t index) const
+        {
+            return index < this->consumed + this->slots.size();
+        }
+
+        // Slot of an admitted item
+        [[nodiscard]] T& at(uint64_t index)
+        {
+            return this->slots[index % this->slots.size()].value;
+        }
+
+        void complete(uint64_t index)
+        {
+            this->slots[index % this->slots.size()].done = true;
+        }
+
+        // Whether the next item in order is complete
+        [[nodiscard]] bool ready() const
+        {
+            return this->slots[this->consumed % this->slots.size()].done;
+        }
+
+        [[nodiscard]] T& front()
+        {
+            return this->slots[this->consumed % this->slots.size()].value;
+        }
+
+        // Moves on to the next item, which admits one more
+        void pop()
+        {
+            this->slots[this->consumed % this->slots.size()].done = false;
+            this->consumed++;
+        }
+
+        // Number of items popped, which is also the index of the next one
+        [[nodiscard]] uint64_t getConsumed() const
+        {
+            return this->consumed;
+        }
+
+        [[nodiscard]] std::size_t size() const
+        {
+            return this->slots.size();
+        }
+
+    private:
+        struct Slot
+        {
+            T value{};
+            bool done = false;
+        };
+
+        std::vector<Slot> slots;
+        uint64_t consumed = 0;
+};
+
+#endif //PNG2BR_REORDERWINDOW_H
\ No newline at end of file
@@ -0,0 +1,247 @@
+#include "resampler.h"
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RESAMPLER_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if defined(RESAMPLER_SSE2) && (defined(__GNUC__) || defined(__clang__))
+#define RESAMPLER_AVX2 1
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    // Horizontal pass results are stored with one bit dropped so they fit into an int16_t,
+    // which lets the vertical pass use a single multiply-add per output pixel pair
+    constexpr uint32_t H_SHIFT = 1;
+    constexpr uint32_t V_SHIFT = BilinearResampler::WEIGHT_BITS * 2 - H_SHIFT;
+
+    void blendRowsScalar(const int16_t* top, const int16_t* bottom, uint16_t weight, unsigned char* out, uint32_t from, uint32_t to)
+    {
+        const int32_t w1 = weight;
+        const int32_t w0 = BilinearResampler::WEIGHT_ONE - weight;
+
+        for (uint32_t x = from; x < to; x++)
+            out[x] = static_cast<unsigned char>((top[x] * w0 + bottom[x] * w1) >> V_SHIFT);
+    }
+
+#if RESAMPLER_SSE2
+    uint32_t blendRowsSSE2(const int16_t* top, const int16_t* bottom, uint16_t weight, unsigned char* out, uint32_t width)
+    {
+        const __m128i weights = _mm_set1_epi32(static_cast<int32_t>(weight) << 16 | (BilinearResampler::WEIGHT_ONE - weight));
+
+        auto blend8 = [&] (const int16_t* a, const int16_t* b) -> __m128i {
+            __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a));
+            __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b));
+            __m128i lo = _mm_srai_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(va, vb), weights), V_SHIFT);
+            __m128i hi = _mm_srai_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(va, vb), weights), V_SHIFT);
+            return _mm_packs_epi32(lo, hi);
+        };
+
+        uint32_t x = 0;
+
+        for (; x + 16 <= width; x += 16)
+        {
+            __m128i r0 = blend8(top + x, bottom + x);
+            __m128i r1 = blend8(top + x + 8, bottom + x + 8);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), _mm_packus_epi16(r0, r1));
+        }
+
+        return x;
+    }
+#endif
+
+#if RESAMPLER_AVX2
+    __attribute__((target("avx2")))
+    inline __m256i blend16AVX2(const int16_t* a, const int16_t* b, __m256i weights)
+    {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b));
+        __m256i lo = _mm256_srai_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(va, vb), weights), V_SHIFT);
+        __m256i hi = _mm256_srai_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(va, vb), weights), V_SHIFT);
+        return _mm256_packs_epi32(lo, hi);
+    }
+
+    __attribute__((target("avx2")))
+    uint32_t blendRowsAVX2(const int16_t* top, const int16_t* bottom, uint16_t weight, unsigned char* out, uint32_t width)
+    {
+        const __m256i weights = _mm256_set1_epi32(static_cast<int32_t>(weight) << 16 | (BilinearResampler::WEIGHT_ONE - weight));
+
+        uint32_t x = 0;
+
+        for (; x + 32 <= width; x += 32)
+        {
+            __m256i r0 = blend16AVX2(top + x, bottom + x, weights);
+            __m256i r1 = blend16AVX2(top + x + 16, bottom + x + 16, weights);
+            __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(r0, r1), 0xD8);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + x), packed);
+        }
+
+        return x;
+    }
+
+    bool hasAVX2()
+    {
+        static const bool supported = __builtin_cpu_supports("avx2");
+        return supported;
+    }
+#endif
+}
+
+BilinearResampler::BilinearResampler(uint32_t srcWidthIn, uint32_t srcHeightIn, uint32_t dstWidthIn, uint32_t dstHeightIn) :
+        srcWidth(srcWidthIn), srcHeight(srcHeightIn), dstWidth(dstWidthIn), dstHeight(dstHeightIn),
+        colTaps(computeTaps(srcWidthIn, dstWidthIn)), rowTaps(computeTaps(srcHeightIn, dstHeightIn))
+{
+
+}
+
+std::vector<BilinearResampler::Tap> BilinearResampler::computeTaps(uint32_t srcSize, uint32_t dstSize)
+{
+    std::vector<Tap> taps(dstSize);
+
+    if (srcSize == 0)
+        return taps;
+
+    for (uint32_t d = 0; d < dstSize; d++)
+    {
+        // Exact rational source position d * src / dst, weight rounded to nearest
+        uint64_t pos = static_cast<uint64_t>(d) * srcSize;
+        auto index = static_cast<uint32_t>(pos / dstSize);
+        uint64_t fract = pos % dstSize;
+
+        taps[d].index0 = index;
+        taps[d].index1 = std::min(index + 1, srcSize - 1);
+        taps[d].weight = static_cast<uint16_t>((fract * WEIGHT_ONE + dstSize / 2) / dstSize);
+    }
+
+    return taps;
+}
+
+std::shared_ptr<const BilinearResampler> BilinearResampler::cached(uint32_t srcWidth, uint32_t srcHeight, uint32_t dstWidth, uint32_t dstHeight)
+{
+    thread_local std::shared_ptr<const BilinearResampler> last;
+
+    if (!last || last->srcWidth != srcWidth || last->srcHeight != srcHeight || last->dstWidth != dstWidth || last->dstHeight != dstHeight)
+        last = std::make_shared<const BilinearResampler>(srcWidth, srcHeight, dstWidth, dstHeight);
+
+    return last;
+}
+
+void BilinearResampler::filterRow(const unsigned char* srcRow, int16_t* out) const
+{
+    this->filterRow(srcRow, out, 0, this->dstWidth);
+}
+
+void BilinearResampler::filterRow(const unsigned char* srcRow, int16_t* out, uint32_t from, uint32_t to) const
+{
+    const Tap* taps = this->colTaps.data();
+
+    for (uint32_t x = from; x < to; x++)
+    {
+        const Tap& tap = taps[x];
+        uint32_t sum = srcRow[tap.index0] * (WEIGHT_ONE - tap.weight) + srcRow[tap.index1] * tap.weight;
+        out[x] = static_cast<int16_t>(sum >> H_SHIFT);
+    }
+}
+
+void BilinearResampler::blendRows(const int16_t* top, const int16_t* bottom, uint16_t weight, unsigned char* out) const
+{
+    this->blendRows(top, bottom, weight, out, 0, this->dstWidth);
+}
+
+void BilinearResampler::blendRows(const int16_t* top, const int16_t* bottom, uint16_t weight, unsigned char* out, uint32_t from, uint32_t to) const
+{
+    uint32_t x = from;
+
+#if RESAMPLER_AVX2
+    if (hasAVX2())
+        x += blendRowsAVX2(top + x, bottom + x, weight, out + x, to - x);
+#endif
+
+#if RESAMPLER_SSE2
+    x += blendRowsSSE2(top + x, bottom + x, weight, out + x, to - x);
+#endif
+
+    blendRowsScalar(top, bottom, weight, out, x, to);
+}
+
+void BilinearResampler::resize(const unsigned char* src, std::size_t srcStride, unsigned char* dst, std::size_t dstStride) const
+{
+    this->resize(src, srcStride, dst, dstStride, 0, 0, this->dstWidth, this->dstHeight);
+}
+
+void BilinearResampler::resize(const unsigned char* src, std::size_t srcStride, unsigned char* dst, std::size_t dstStride,
+                               uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1) const
+{
+    if (this->srcWidth == 0 || this->srcHeight == 0)
+    {
+        for (uint32_t y = y0; y < y1; y++)
+            std::fill(dst + y * dstStride + x0, dst + y * dstStride + x1, 0);
+
+        return;
+    }
+
+    // Two filtered source rows are enough, output rows only ever move downwards
+    thread_local std::vector<int16_t> rowBuf;
+    rowBuf.resize(static_cast<std::size_t>(this->dstWidth) * 2);
+
+    int16_t* rows[2] = { rowBuf.data(), rowBuf.data() + this->dstWidth };
+    int64_t rowIdx[2] = { -1, -1 };
+
+    auto fetchRow = [&] (uint32_t srcY, int64_t keepY) -> const int16_t* {
+        for (int i = 0; i < 2; i++)
+        {
+            if (rowIdx[i] == srcY)
+                return rows[i];
+        }
+
+        int slot = rowIdx[0] == keepY ? 1 : 0;
+        this->filterRow(src + srcY * srcStride, rows[slot], x0, x1);
+        rowIdx[slot] = srcY;
+        return rows[slot];
+    };
+
+    for (uint32_t y = y0; y < y1; y++)
+    {
+        const Tap& tap = this->rowTaps[y];
+
+        // Integer scale factors hit the top row exactly, the bottom one is not needed then
+        const int16_t* top = fetchRow(tap.index0, tap.index1);
+        const int16_t* bottom = tap.weight == 0 ? top : fetchRow(tap.index1, tap.index0);
+
+        this->blendRows(top, bottom, tap.weight, dst + y * dstStride, x0, x1);
+    }
+}
+
+const BilinearResampler::Tap& BilinearResampler::getRowTap(uint32_t dstY) const
+{
+    return this->rowTaps[dstY];
+}
+
+const BilinearResampler::Tap& BilinearResampler::getColumnTap(uint32_t dstX) const
+{
+    return this->colTaps[dstX];
+}
+
+uint32_t BilinearResampler::getSrcWidth() const
+{
+    return this->srcWidth;
+}
+
+uint32_t BilinearResampler::getSrcHeight() const
+{
+    return this->srcHeight;
+}
+
+uint32_t BilinearResampler::getDstWidth() const
+{
+    return this->dstWidth;
+}
+
+uint32_t BilinearResampler::getDstHeight() const
+{
+    return this->dstHeight;
+}
\ No newline at end of file
@@ -0,0 +1,68 @@
+#ifndef PNG2BR_RESAMPLER_H
+#define PNG2BR_RESAMPLER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/*
+ * Fixed-point bilinear resampler.
+ *
+ * All tap indices and weights are computed once per (source, destination) size
+ * pair, the per-pixel work is then integer only. The image is filtered
+ * horizontally into 15-bit intermediate rows first, those are blended
+ * vertically with SSE2/AVX2 where available.
+ */
+class BilinearResampler
+{
+    public:
+        static constexpr uint32_t WEIGHT_BITS = 8;
+        static constexpr uint32_t WEIGHT_ONE = 1u << WEIGHT_BITS;
+
+        struct Tap
+        {
+            uint32_t index0;
+            uint32_t index1;
+            // Weight of index1, index0 gets WEIGHT_ONE - weight
+            uint16_t weight;
+        };
+
+        BilinearResampler(uint32_t srcWidth, uint32_t srcHeight, uint32_t dstWidth, uint32_t dstHeight);
+
+        // Returns a resampler for the given sizes, reusing the last one built on this thread
+        static std::shared_ptr<const BilinearResampler> cached(uint32_t srcWidth, uint32_t srcHeight, uint32_t dstWidth, uint32_t dstHeight);
+
+        void resize(const unsigned char* src, std::size_t srcStride, unsigned char* dst, std::size_t dstStride) const;
+        // Only computes the destination rectangle [x0, x1) x [y0, y1), the rest of dst is left as is
+        void resize(const unsigned char* src, std::size_t srcStride, unsigned char* dst, std::size_t dstStride,
+                    uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1) const;
+
+        // Building blocks for streaming use, intermediate rows are getDstWidth() int16_t values,
+        // the span versions only touch the destination columns [from, to)
+        void filterRow(const unsigned char* srcRow, int16_t* out) const;
+        void filterRow(const unsigned char* srcRow, int16_t* out, uint32_t from, uint32_t to) const;
+        void blendRows(const int16_t* top, const int16_t* bottom, uint16_t weight, unsigned char* out) const;
+        void blendRows(const int16_t* top, const int16_t* bottom, uint16_t weight, unsigned char* out, uint32_t from, uint32_t to) const;
+
+        // Source rows and columns a destination row or column is interpolated from
+        [[nodiscard]] const Tap& getRowTap(uint32_t dstY) const;
+        [[nodiscard]] const Tap& getColumnTap(uint32_t dstX) const;
+        [[nodiscard]] uint32_t getSrcWidth() const;
+        [[nodiscard]] uint32_t getSrcHeight() const;
+        [[nodiscard]] uint32_t getDstWidth() const;
+        [[nodiscard]] uint32_t getDstHeight() const;
+
+    private:
+        static std::vector<Tap> computeTaps(uint32_t srcSize, uint32_t dstSize);
+
+        uint32_t srcWidth;
+        uint32_t srcHeight;
+        uint32_t dstWidth;
+        uint32_t dstHeight;
+
+        std::vector<Tap> colTaps;
+        std::vector<Tap> rowTaps;
+};
+
+#endif //PNG2BR_RESAMPLER_H
\ No newline at end of file
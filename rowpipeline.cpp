@@ -0,0 +1,284 @@
+#include "rowpipeline.h"
+#include "dither.h"
+#include "resampler.h"
+
+#include <algorithm>
+#include <climits>
+
+namespace
+{
+    class SourceStage : public RowStage
+    {
+        public:
+            explicit SourceStage(const GConstImageView& viewIn) : RowStage(viewIn.width, viewIn.height), view(viewIn)
+            {
+
+            }
+
+            const unsigned char* getRow(uint32_t y) override
+            {
+                return this->view.row(y);
+            }
+
+        private:
+            GConstImageView view;
+    };
+
+    class LUTStage : public RowStage
+    {
+        public:
+            LUTStage(RowStage& upstreamIn, const GImage::LUT& lutIn) :
+                    RowStage(upstreamIn.getWidth(), upstreamIn.getHeight()), upstream(upstreamIn), lut(lutIn), row(upstreamIn.getWidth())
+            {
+
+            }
+
+            const unsigned char* getRow(uint32_t y) override
+            {
+                const unsigned char* in = this->upstream.getRow(y);
+
+                for (uint32_t x = 0; x < this->width; x++)
+                    this->row[x] = this->lut[in[x]];
+
+                return this->row.data();
+            }
+
+        private:
+            RowStage& upstream;
+            GImage::LUT lut;
+            std::vector<unsigned char> row;
+    };
+
+    class ResampleStage : public RowStage
+    {
+        public:
+            ResampleStage(RowStage& upstreamIn, uint32_t newWidth, uint32_t newHeight) :
+                    RowStage(newWidth, newHeight), upstream(upstreamIn),
+                    resampler(BilinearResampler::cached(upstreamIn.getWidth(), upstreamIn.getHeight(), newWidth, newHeight)),
+                    filtered(static_cast<std::size_t>(newWidth) * 2), row(newWidth)
+            {
+
+            }
+
+            const unsigned char* getRow(uint32_t y) override
+            {
+                if (this->upstream.getWidth() == 0 || this->upstream.getHeight() == 0)
+                {
+                    std::fill(this->row.begin(), this->row.end(), 0);
+                    return this->row.data();
+                }
+
+                const BilinearResampler::Tap& tap = this->resampler->getRowTap(y);
+                const int16_t* top = this->fetch(tap.index0, tap.index1);
+                const int16_t* bottom = tap.weight == 0 ? top : this->fetch(tap.index1, tap.index0);
+
+                this->resampler->blendRows(top, bottom, tap.weight, this->row.data());
+
+                return this->row.data();
+            }
+
+        private:
+            const int16_t* fetch(uint32_t srcY, int64_t keepY)
+            {
+                for (int i = 0; i < 2; i++)
+                {
+                    if (this->filteredIdx[i] == srcY)
+                        return this->filteredRow(i);
+                }
+
+                int slot = this->filteredIdx[0] == keepY ? 1 : 0;
+                this->resampler->filterRow(this->upstream.getRow(srcY), this->filteredRow(slot));
+                this->filteredIdx[slot] = srcY;
+                return this->filteredRow(slot);
+            }
+
+            int16_t* filteredRow(int slot)
+            {
+                return this->filtered.data() + slot * this->width;
+            }
+
+            RowStage& upstream;
+            std::shared_ptr<const BilinearResampler> resampler;
+            std::vector<int16_t> filtered;
+            int64_t filteredIdx[2] = { -1, -1 };
+            std::vector<unsigned char> row;
+    };
+
+    class DitherStage : public RowStage
+    {
+        public:
+            DitherStage(RowStage& upstreamIn, unsigned char threshold, DiffusionKernel kernel, bool serpentine) :
+                    RowStage(upstreamIn.getWidth(), upstreamIn.getHeight()), upstream(upstreamIn),
+                    diffuser(kernel, serpentine), row(upstreamIn.getWidth())
+            {
+                this->diffuser.begin(this->width, threshold);
+            }
+
+            const unsigned char* getRow(uint32_t y) override
+            {
+                this->diffuser.diffuseRow(this->upstream.getRow(y), this->row.data());
+                return this->row.data();
+            }
+
+        private:
+            RowStage& upstream;
+            ErrorDiffuser diffuser;
+            std::vector<unsigned char> row;
+    };
+
+    class OrderedDitherStage : public RowStage
+    {
+        public:
+            OrderedDitherStage(RowStage& upstreamIn, unsigned char threshold, OrderedPattern pattern) :
+                    RowStage(upstreamIn.getWidth(), upstreamIn.getHeight()), upstream(upstreamIn),
+                    ditherer(pattern), row(upstreamIn.getWidth())
+            {
+                this->ditherer.begin(this->width, threshold);
+            }
+
+            const unsigned char* getRow(uint32_t y) override
+            {
+                this->ditherer.ditherRow(this->upstream.getRow(y), this->row.data(), y);
+                return this->row.data();
+            }
+
+        private:
+            RowStage& upstream;
+            OrderedDitherer ditherer;
+            std::vector<unsigned char> row;
+    };
+
+    class ThresholdStage : public RowStage
+    {
+        public:
+            ThresholdStage(RowStage& upstreamIn, unsigned char thresholdIn) :
+                    RowStage(upstreamIn.getWidth(), upstreamIn.getHeight()), upstream(upstreamIn), threshold(thresholdIn), row(upstreamIn.getWidth())
+            {
+
+            }
+
+            const unsigned char* getRow(uint32_t y) override
+            {
+                const unsigned char* in = this->upstream.getRow(y);
+
+                for (uint32_t x = 0; x < this->width; x++)
+                    this->row[x] = (in[x] > this->threshold) * UCHAR_MAX;
+
+                return this->row.data();
+            }
+
+        private:
+            RowStage& upstream;
+            unsigned char threshold;
+            std::vector<unsigned char> row;
+    };
+}
+
+RowStage::RowStage(uint32_t widthIn, uint32_t heightIn) : width(widthIn), height(heightIn)
+{
+
+}
+
+uint32_t RowStage::getWidth() const
+{
+    return this->width;
+}
+
+uint32_t RowStage::getHeight() const
+{
+    return this->height;
+}
+
+RowPipeline::RowPipeline(const GImage& source) : RowPipeline(source.view())
+{
+
+}
+
+RowPipeline::RowPipeline(const GConstImageView& source)
+{
+    this->stages.push_back(std::make_unique<SourceStage>(source));
+}
+
+RowStage& RowPipeline::last()
+{
+    return *this->stages.back();
+}
+
+RowPipeline& RowPipeline::gamma(double correction)
+{
+    return this->lut(GImage::gamma_lut(correction));
+}
+
+RowPipeline& RowPipeline::lut(const GImage::LUT& table)
+{
+    this->stages.push_back(std::make_unique<LUTStage>(this->last(), table));
+    return *this;
+}
+
+RowPipeline& RowPipeline::resize(uint32_t newWidth, uint32_t newHeight)
+{
+    if (newWidth == this->getWidth() && newHeight == this->getHeight())
+        return *this;
+
+    this->stages.push_back(std::make_unique<ResampleStage>(this->last(), newWidth, newHeight));
+    return *this;
+}
+
+RowPipeline& RowPipeline::dither(unsigned char threshold, DiffusionKernel kernel, bool serpentine)
+{
+    this->stages.push_back(std::make_unique<DitherStage>(this->last(), threshold, kernel, serpentine));
+    return *this;
+}
+
+RowPipeline& RowPipeline::dither_ordered(unsigned char threshold, OrderedPattern pattern)
+{
+    this->stages.push_back(std::make_unique<OrderedDitherStage>(this->last(), threshold, pattern));
+    return *this;
+}
+
+RowPipeline& RowPipeline::binary_threshold(unsigned char threshold)
+{
+    this->stages.push_back(std::make_unique<ThresholdStage>(this->last(), threshold));
+    return *this;
+}
+
+void RowPipeline::run(GImage& output)
+{
+    RowStage& stage = this->last();
+    const uint32_t width = stage.getWidth();
+    const uint32_t height = stage.getHeight();
+
+    output.realloc_size(width, height);
+
+    for (uint32_t y = 0; y < height; y++)
+        std::copy_n(stage.getRow(y), width, output.data() + y * width);
+}
+
+GImage RowPipeline::run()
+{
+    GImage output;
+    this->run(output);
+    return output;
+}
+
+void RowPipeline::run(GBitImage& output)
+{
+    RowStage& stage = this->last();
+    const uint32_t width = stage.getWidth();
+    const uint32_t height = stage.getHeight();
+
+    output.realloc_size(width, height);
+
+    for (uint32_t y = 0; y < height; y++)
+        GBitImage::pack_row(stage.getRow(y), output.row(y), width);
+}
+
+uint32_t RowPipeline::getWidth() const
+{
+    return this->stages.back()->getWidth();
+}
+
+uint32_t RowPipeline::getHeight() const
+{
+    return this->stages.back()->getHeight();
+}
\ No newline at end of file
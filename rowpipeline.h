@@ -0,0 +1,68 @@
+#ifndef PNG2BR_ROWPIPELINE_H
+#define PNG2BR_ROWPIPELINE_H
+
+#include "image.h"
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+/*
+ * A single stage of a row streaming pipeline. Stages pull rows from
+ * their upstream stage on demand and only keep the few rows they need,
+ * so no full size intermediate image is ever allocated.
+ */
+class RowStage
+{
+    public:
+        virtual ~RowStage() = default;
+
+        // Rows must be requested in non-decreasing order, the returned pointer
+        // is only valid until the next call
+        virtual const unsigned char* getRow(uint32_t y) = 0;
+
+        [[nodiscard]] uint32_t getWidth() const;
+        [[nodiscard]] uint32_t getHeight() const;
+
+    protected:
+        RowStage(uint32_t width, uint32_t height);
+
+        uint32_t width;
+        uint32_t height;
+};
+
+/*
+ * Composes GImage operations into a single pass over the source, e.g.
+ *
+ *     RowPipeline(img).gamma(2.2).resize(640, 360).dither(threshold).run(output);
+ *
+ * walks the source once and writes the dithered output once.
+ */
+class RowPipeline
+{
+    public:
+        explicit RowPipeline(const GImage& source);
+        explicit RowPipeline(const GConstImageView& source);
+
+        RowPipeline& gamma(double correction);
+        RowPipeline& lut(const GImage::LUT& table);
+        RowPipeline& resize(uint32_t newWidth, uint32_t newHeight);
+        RowPipeline& dither(unsigned char threshold, DiffusionKernel kernel = DiffusionKernel::FloydSteinberg, bool serpentine = false);
+        RowPipeline& dither_ordered(unsigned char threshold, OrderedPattern pattern = OrderedPattern::Bayer8);
+        RowPipeline& binary_threshold(unsigned char threshold);
+
+        void run(GImage& output);
+        [[nodiscard]] GImage run();
+        // Packs each row as it comes out of the last stage, for pipelines ending in a threshold or dither
+        void run(GBitImage& output);
+
+        [[nodiscard]] uint32_t getWidth() const;
+        [[nodiscard]] uint32_t getHeight() const;
+
+    private:
+        RowStage& last();
+
+        std::vector<std::unique_ptr<RowStage>> stages;
+};
+
+#endif //PNG2BR_ROWPIPELINE_H
\ No newline at end of file
@@ -0,0 +1,96 @@
+#include "scenedetector.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    // Weight of the newest distance in the running average
+    constexpr double DISTANCE_SMOOTHING = 0.1;
+    // How far the smoothed threshold may drift from the current one before it is followed
+    constexpr double THRESHOLD_HYSTERESIS = 0.75;
+}
+
+SceneDetector::SceneDetector(double smoothingIn) : smoothing(std::clamp(smoothingIn, 0.0, 1.0))
+{
+
+}
+
+void SceneDetector::setSmoothing(double smoothingIn)
+{
+    this->smoothing = std::clamp(smoothingIn, 0.0, 1.0);
+}
+
+void SceneDetector::setCutSensitivity(double minDistance, double factor)
+{
+    this->minCutDistance = minDistance;
+    this->cutFactor = factor;
+}
+
+const SceneDetector::Result& SceneDetector::update(const GImage::Histogram& histogram)
+{
+    Signature signature{};
+    double total = 0;
+
+    for (uint32_t i = 0; i < GImage::levels; i++)
+    {
+        signature[i * BINS / GImage::levels] += histogram[i];
+        total += histogram[i];
+    }
+
+    if (total > 0)
+    {
+        for (auto& bin : signature)
+            bin /= total;
+    }
+
+    double distance = 0;
+
+    for (uint32_t i = 0; i < BINS; i++)
+        distance += std::abs(signature[i] - this->previous[i]);
+
+    distance /= 2;
+
+    const unsigned char otsu = GImage::otsu(histogram);
+
+    bool cut = !this->hasPrevious ||
+            (distance >= this->minCutDistance && distance >= this->averageDistance * this->cutFactor);
+
+    if (cut)
+    {
+        this->smoothedThreshold = otsu;
+        this->result.threshold = otsu;
+        this->cutCount++;
+    }
+    else
+    {
+        this->averageDistance += (distance - this->averageDistance) * DISTANCE_SMOOTHING;
+        this->smoothedThreshold += (otsu - this->smoothedThreshold) * this->smoothing;
+
+        if (std::abs(this->smoothedThreshold - this->result.threshold) >= THRESHOLD_HYSTERESIS)
+            this->result.threshold = static_cast<unsigned char>(std::lround(this->smoothedThreshold));
+    }
+
+    this->result.cut = cut;
+    this->result.distance = this->hasPrevious ? distance : 1.0;
+    this->previous = signature;
+    this->hasPrevious = true;
+
+    return this->result;
+}
+
+void SceneDetector::reset()
+{
+    this->hasPrevious = false;
+    this->averageDistance = 0;
+}
+
+const SceneDetector::Result& SceneDetector::getResult() const
+{
+    return this->result;
+}
+
+uint64_t SceneDetector::getCutCount() const
+{
+    return this->cutCount;
+}
\ No newline at end of file
@@ -0,0 +1,64 @@
+#ifndef PNG2BR_SCENEDETECTOR_H
+#define PNG2BR_SCENEDETECTOR_H
+
+#include "image.h"
+
+#include <array>
+#include <cstdint>
+
+/*
+ * Detects scene cuts from the luma histograms of consecutive frames and
+ * keeps a temporally smoothed dithering threshold.
+ *
+ * Histograms are folded into coarse bins and compared by their normalised
+ * L1 distance, which is cheap and insensitive to noise and small exposure
+ * changes. A cut is a distance well above the running average distance,
+ * so steady camera motion does not count as one. Between cuts the Otsu
+ * threshold follows an exponential moving average with a little hysteresis,
+ * which keeps near-static footage from flickering. On a cut the threshold
+ * jumps straight to the new frame's Otsu threshold.
+ */
+class SceneDetector
+{
+    public:
+        struct Result
+        {
+            bool cut = false;
+            unsigned char threshold = 0;
+            // Normalised histogram distance to the previous frame, 0-1
+            double distance = 0;
+        };
+
+        // smoothing is the weight of the newest frame's threshold, 1 disables smoothing
+        explicit SceneDetector(double smoothing = 0.2);
+
+        void setSmoothing(double smoothing);
+        // A cut needs a distance of at least minDistance and factor times the average distance
+        void setCutSensitivity(double minDistance, double factor);
+
+        const Result& update(const GImage::Histogram& histogram);
+        // The next frame is treated as a cut
+        void reset();
+
+        [[nodiscard]] const Result& getResult() const;
+        [[nodiscard]] uint64_t getCutCount() const;
+
+    private:
+        static constexpr uint32_t BINS = 32;
+
+        typedef std::array<double, BINS> Signature;
+
+        double smoothing;
+        double minCutDistance = 0.3;
+        double cutFactor = 4.0;
+
+        bool hasPrevious = false;
+        Signature previous{};
+        double averageDistance = 0;
+        double smoothedThreshold = 0;
+        uint64_t cutCount = 0;
+
+        Result result;
+};
+
+#endif //PNG2BR_SCENEDETECTOR_H
\ No newline at end of file
@@ -0,0 +1,214 @@
+#include "scheduler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <thread>
+
+namespace
+{
+    // Weight of the newest frame in the drop rate
+    constexpr double DROP_RATE_SMOOTHING = 1.0 / 32;
+    // The skip level is raised above the first rate and lowered below the second
+    constexpr double ENGAGE_DROP_RATE = 0.3;
+    constexpr double RELEASE_DROP_RATE = 0.05;
+    constexpr uint32_t MAX_SKIP_LEVEL = 2;
+    // Skipping lowers the drop rate by itself, so a level is kept for a while before it is reconsidered
+    constexpr uint64_t MIN_SKIP_FRAMES = 120;
+    // A late frame beats none at all
+    constexpr std::chrono::milliseconds MAX_FRAME_GAP(250);
+
+    constexpr std::array<double, LatenessHistogram::BUCKETS - 1> LATENESS_LIMITS = {
+        0.0001, 0.00025, 0.0005, 0.001, 0.002, 0.004, 0.008, 0.016, 1.0 / 30
+    };
+}
+
+void LatenessHistogram::add(double seconds)
+{
+    const auto bucket = static_cast<uint32_t>(std::upper_bound(LATENESS_LIMITS.begin(), LATENESS_LIMITS.end(), seconds) - LATENESS_LIMITS.begin());
+
+    this->buckets[bucket]++;
+    this->count++;
+    this->sum += seconds;
+    this->max = this->count == 1 ? seconds : std::max(this->max, seconds);
+}
+
+uint64_t LatenessHistogram::getCount() const
+{
+    return this->count;
+}
+
+double LatenessHistogram::getMean() const
+{
+    return this->count ? this->sum / static_cast<double>(this->count) : 0;
+}
+
+double LatenessHistogram::getMax() const
+{
+    return this->max;
+}
+
+double LatenessHistogram::percentile(double fraction) const
+{
+    const auto target = static_cast<uint64_t>(std::ceil(fraction * static_cast<double>(this->count)));
+    uint64_t seen = 0;
+
+    for (uint32_t i = 0; i + 1 < BUCKETS; i++)
+    {
+        seen += this->buckets[i];
+
+        if (seen >= target && seen > 0)
+            return std::min(LATENESS_LIMITS[i], this->max);
+    }
+
+    return this->max;
+}
+
+const std::array<uint64_t, LatenessHistogram::BUCKETS>& LatenessHistogram::getBuckets() const
+{
+    return this->buckets;
+}
+
+double LatenessHistogram::getLimit(uint32_t bucket)
+{
+    return bucket < LATENESS_LIMITS.size() ? LATENESS_LIMITS[bucket] : std::numeric_limits<double>::infinity();
+}
+
+PlaybackScheduler::PlaybackScheduler(double lateThresholdIn) : lateThreshold(std::max(lateThresholdIn, 0.0))
+{
+
+}
+
+void PlaybackScheduler::setLateThreshold(double seconds)
+{
+    this->lateThreshold = std::max(seconds, 0.0);
+}
+
+void PlaybackScheduler::setSpin(std::chrono::microseconds spinIn)
+{
+    this->spin = std::max(spinIn, std::chrono::microseconds(0));
+}
+
+void PlaybackScheduler::start(double timestamp)
+{
+    auto offset = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(timestamp));
+
+    const auto now = Clock::now();
+
+    this->origin.store((now - offset).time_since_epoch().count(), std::memory_order_relaxed);
+    this->lastPresented.store(now.time_since_epoch().count(), std::memory_order_relaxed);
+    this->started.store(true, std::memory_order_release);
+}
+
+bool PlaybackScheduler::isStarted() const
+{
+    return this->started.load(std::memory_order_acquire);
+}
+
+PlaybackScheduler::Clock::time_point PlaybackScheduler::deadline(double timestamp) const
+{
+    auto offset = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(timestamp));
+
+    return Clock::time_point(Clock::duration(this->origin.load(std::memory_order_relaxed))) + offset;
+}
+
+double PlaybackScheduler::lateness(double timestamp) const
+{
+    if (!this->isStarted())
+        return 0;
+
+    return std::chrono::duration<double>(Clock::now() - this->deadline(timestamp)).count();
+}
+
+bool PlaybackScheduler::isLate(double timestamp) const
+{
+    return this->lateThreshold > 0 && this->lateness(timestamp) > this->lateThreshold;
+}
+
+bool PlaybackScheduler::shouldDrop(double timestamp) const
+{
+    if (this->lateThreshold <= 0 || !this->isStarted())
+        return false;
+
+    if (!this->backpressure.load(std::memory_order_relaxed) && !this->isLate(timestamp))
+        return false;
+
+    const Clock::time_point last(Clock::duration(this->lastPresented.load(std::memory_order_relaxed)));
+
+    return Clock::now() - last < MAX_FRAME_GAP;
+}
+
+void PlaybackScheduler::setBackpressure(bool backedUp)
+{
+    this->backpressure.store(backedUp, std::memory_order_relaxed);
+}
+
+void PlaybackScheduler::waitFor(double timestamp) const
+{
+    const Clock::time_point due = this->deadline(timestamp);
+
+    // Absolute deadlines, so oversleeping once does not shift every later frame
+    std::this_thread::sleep_until(due - this->spin);
+
+    while (Clock::now() < due)
+        ;
+}
+
+void PlaybackScheduler::presented(double timestamp)
+{
+    const Clock::time_point now = Clock::now();
+
+    this->stats.presented++;
+    this->latenessHistogram.add(std::chrono::duration<double>(now - this->deadline(timestamp)).count());
+    this->lastPresented.store(now.time_since_epoch().count(), std::memory_order_relaxed);
+    this->update(false);
+}
+
+void PlaybackScheduler::dropped(bool beforeProcessing)
+{
+    if (beforeProcessing)
+        this->stats.droppedBeforeProcessing++;
+    else
+        this->stats.droppedAtDisplay++;
+
+    this->update(true);
+}
+
+void PlaybackScheduler::update(bool drop)
+{
+    this->dropRate += ((drop ? 1.0 : 0.0) - this->dropRate) * DROP_RATE_SMOOTHING;
+    this->framesAtLevel++;
+
+    if (this->lateThreshold <= 0)
+        return;
+
+    // The first level is taken right away, further ones only once the previous one had its chance
+    const bool held = this->skipLevel == 0 || this->framesAtLevel >= MIN_SKIP_FRAMES;
+
+    if (this->dropRate > ENGAGE_DROP_RATE && this->skipLevel < MAX_SKIP_LEVEL && held)
+    {
+        this->skipLevel++;
+        this->framesAtLevel = 0;
+        this->stats.skipEngaged++;
+    }
+    else if (this->dropRate < RELEASE_DROP_RATE && this->skipLevel > 0 && held)
+    {
+        this->skipLevel--;
+        this->framesAtLevel = 0;
+    }
+}
+
+uint32_t PlaybackScheduler::getSkipLevel() const
+{
+    return this->skipLevel;
+}
+
+const PlaybackScheduler::Stats& PlaybackScheduler::getStats() const
+{
+    return this->stats;
+}
+
+const LatenessHistogram& PlaybackScheduler::getLateness() const
+{
+    return this->latenessHistogram;
+}
\ No newline at end of file
@@ -0,0 +1,126 @@
+#ifndef PNG2BR_SCHEDULER_H
+#define PNG2BR_SCHEDULER_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+/*
+ * Distribution of how late frames were presented, in roughly logarithmic
+ * buckets from 0.1 ms up to a frame at 30 fps and beyond.
+ */
+class LatenessHistogram
+{
+    public:
+        static constexpr uint32_t BUCKETS = 10;
+
+        void add(double seconds);
+
+        [[nodiscard]] uint64_t getCount() const;
+        [[nodiscard]] double getMean() const;
+        [[nodiscard]] double getMax() const;
+        // Upper bound of the bucket holding the given fraction of the samples, the maximum for the last one
+        [[nodiscard]] double percentile(double fraction) const;
+
+        [[nodiscard]] const std::array<uint64_t, BUCKETS>& getBuckets() const;
+        // Upper bound of a bucket in seconds, infinite for the last one
+        [[nodiscard]] static double getLimit(uint32_t bucket);
+
+    private:
+        std::array<uint64_t, BUCKETS> buckets{};
+        uint64_t count = 0;
+        double sum = 0;
+        double max = 0;
+};
+
+/*
+ * Keeps playback in sync with the wall clock instead of showing every frame.
+ *
+ * The clock starts with the first presented frame, every later frame is due
+ * at the start time plus the difference of the timestamps. Frames more than
+ * the late threshold behind are dropped, by the workers before they are
+ * processed or by the display if they got late while queued.
+ *
+ * Dropping does not help once decoding alone is too slow, so a moving
+ * average of the drop rate decides when the decoder should skip
+ * non-reference frames, and keyframes only if that is still not enough,
+ * with hysteresis and a minimum hold so it does not toggle every few
+ * frames. However late playback is, a frame is shown at least every
+ * quarter second.
+ *
+ * While the output is backed up frames are dropped as if they were late,
+ * rather than stalling the display behind a slow terminal.
+ *
+ * Waiting for a deadline sleeps until shortly before it and optionally
+ * busy-waits for the rest, since sleeps tend to overshoot by tens of
+ * microseconds or more on a loaded system. How late each presented frame
+ * actually was goes into a histogram.
+ */
+class PlaybackScheduler
+{
+    public:
+        typedef std::chrono::steady_clock Clock;
+
+        struct Stats
+        {
+            uint64_t presented = 0;
+            uint64_t droppedBeforeProcessing = 0;
+            uint64_t droppedAtDisplay = 0;
+            // Times the skip level was raised
+            uint64_t skipEngaged = 0;
+        };
+
+        // Frames more than lateThreshold seconds behind are dropped, 0 disables dropping and skipping
+        explicit PlaybackScheduler(double lateThresholdIn = 0.04);
+
+        // Has to be set before the clock starts
+        void setLateThreshold(double seconds);
+        // Busy-waits for this long before each deadline instead of sleeping, 0 only sleeps
+        void setSpin(std::chrono::microseconds spinIn);
+
+        // Display: starts the clock so that the frame with the given timestamp is due now
+        void start(double timestamp);
+        [[nodiscard]] bool isStarted() const;
+        [[nodiscard]] Clock::time_point deadline(double timestamp) const;
+        // Seconds the frame is behind its due time, negative while it is early, 0 before start()
+        [[nodiscard]] double lateness(double timestamp) const;
+        // Any thread: true if a frame with the given timestamp is too late to be shown
+        [[nodiscard]] bool isLate(double timestamp) const;
+        // Any thread: true if the frame should not be shown, because it is late or the output is backed up
+        [[nodiscard]] bool shouldDrop(double timestamp) const;
+        // Any thread: the output can not take another frame right now
+        void setBackpressure(bool backedUp);
+        // Display: returns once the frame with the given timestamp is due
+        void waitFor(double timestamp) const;
+
+        // Display: records what happened to every frame, in presentation order.
+        // A frame counts as presented when its output starts, its lateness is taken then
+        void presented(double timestamp);
+        void dropped(bool beforeProcessing);
+        // 0 decodes every frame, 1 skips non-reference frames, 2 keyframes only
+        [[nodiscard]] uint32_t getSkipLevel() const;
+
+        [[nodiscard]] const Stats& getStats() const;
+        [[nodiscard]] const LatenessHistogram& getLateness() const;
+
+    private:
+        void update(bool drop);
+
+        double lateThreshold;
+        std::chrono::microseconds spin{ 0 };
+
+        // Clock times of timestamp 0 and of the last presented frame, read by the workers
+        std::atomic<Clock::rep> origin{ 0 };
+        std::atomic<Clock::rep> lastPresented{ 0 };
+        std::atomic<bool> started{ false };
+        std::atomic<bool> backpressure{ false };
+
+        double dropRate = 0;
+        uint32_t skipLevel = 0;
+        uint64_t framesAtLevel = 0;
+        Stats stats;
+        LatenessHistogram latenessHistogram;
+};
+
+#endif //PNG2BR_SCHEDULER_H
\ No newline at end of file
@@ -0,0 +1,420 @@
+#include "sink.h"
+#include "util.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    [[noreturn]] void throwError(const std::string& what)
+    {
+        throw std::runtime_error(what + ": " + std::strerror(errno));
+    }
+}
+
+bool OutputSink::takeKeyframeRequest()
+{
+    return false;
+}
+
+StreamSink::StreamSink(int fdIn) : fd(fdIn)
+{
+
+}
+
+void StreamSink::write(const std::vector<const OutputFrame*>& frames)
+{
+    std::vector<Span> spans;
+
+    for (const OutputFrame* frame : frames)
+        spans.push_back({ frame->data.data(), frame->data.size() });
+
+    this->writeSpans(spans);
+}
+
+void StreamSink::writeSpans(std::vector<Span>& spans)
+{
+#ifdef _WIN32
+    for (Span& span : spans)
+    {
+        while (span.size)
+        {
+            const int written = _write(this->fd, span.data, static_cast<unsigned int>(std::min<std::size_t>(span.size, INT_MAX)));
+
+            if (written < 0)
+                throwError("Could not write output");
+
+            span.data += written;
+            span.size -= static_cast<std::size_t>(written);
+        }
+    }
+#else
+    std::vector<iovec> iov;
+
+    for (const Span& span : spans)
+    {
+        if (span.size)
+            iov.push_back({ const_cast<char*>(span.data), span.size });
+    }
+
+    std::size_t first = 0;
+
+    while (first < iov.size())
+    {
+        const ssize_t result = ::writev(this->fd, iov.data() + first, static_cast<int>(std::min<std::size_t>(iov.size() - first, IOV_MAX)));
+
+        if (result < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            throwError("Could not write output");
+        }
+
+        // Skips what was written, a short write may end in the middle of a span
+        auto written = static_cast<std::size_t>(result);
+
+        while (first < iov.size() && written >= iov[first].iov_len)
+            written -= iov[first++].iov_len;
+
+        if (written)
+        {
+            iov[first].iov_base = static_cast<char*>(iov[first].iov_base) + written;
+            iov[first].iov_len -= written;
+        }
+    }
+#endif
+}
+
+TerminalSink::TerminalSink() : StreamSink(fileno(stdout))
+{
+#ifdef _WIN32
+    HANDLE console = GetStdHandle(STD_OUTPUT_HANDLE);
+    DWORD mode;
+    GetConsoleMode(console, &mode);
+    SetConsoleMode(console, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+#endif
+}
+
+FileSink::FileSink(const std::filesystem::path& path) : StreamSink(-1)
+{
+#ifdef _WIN32
+    this->fd = _wopen(path.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    this->fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+#endif
+
+    if (this->fd < 0)
+        throwError("Could not open " + path.string());
+}
+
+FileSink::~FileSink()
+{
+#ifdef _WIN32
+    _close(this->fd);
+#else
+    ::close(this->fd);
+#endif
+}
+
+RecordingSink::RecordingSink(const std::filesystem::path& path) : FileSink(path)
+{
+
+}
+
+void RecordingSink::write(const std::vector<const OutputFrame*>& frames)
+{
+    std::vector<Span> spans;
+
+    if (!this->headerWritten)
+    {
+        spans.push_back({ MAGIC, sizeof(MAGIC) });
+        this->headerWritten = true;
+    }
+
+    // The spans point into it, so it must not grow while they are built
+    this->headers.resize(frames.size());
+
+    for (std::size_t i = 0; i < frames.size(); i++)
+    {
+        const OutputFrame& frame = *frames[i];
+        char* header = this->headers[i].data();
+
+        store_le(header, static_cast<int64_t>(std::llround(frame.timestamp * 1000000.0)));
+        store_le(header + 8, static_cast<uint32_t>(frame.data.size()));
+        store_le(header + 12, frame.keyframe ? FLAG_KEYFRAME : 0u);
+
+        spans.push_back({ header, RECORD_HEADER_SIZE });
+        spans.push_back({ frame.data.data(), frame.data.size() });
+    }
+
+    this->writeSpans(spans);
+}
+
+RecordingReader::RecordingReader(const std::filesystem::path& path) : input(path, std::ios::binary)
+{
+    char magic[sizeof(RecordingSink::MAGIC)];
+
+    if (!this->input)
+        throwError("Could not open " + path.string());
+
+    if (!this->input.read(magic, sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), RecordingSink::MAGIC))
+        throw std::runtime_error(path.string() + " is not a recording");
+}
+
+bool RecordingReader::next(OutputFrame& frame)
+{
+    char header[RecordingSink::RECORD_HEADER_SIZE];
+
+    this->input.read(header, sizeof(header));
+
+    if (this->input.gcount() == 0)
+        return false;
+
+    if (this->input.gcount() != sizeof(header))
+        throw std::runtime_error("Truncated recording");
+
+    frame.timestamp = static_cast<double>(load_le<int64_t>(header)) / 1000000.0;
+    frame.data.resize(load_le<uint32_t>(header + 8));
+    frame.keyframe = load_le<uint32_t>(header + 12) & RecordingSink::FLAG_KEYFRAME;
+
+    if (!this->input.read(frame.data.data(), static_cast<std::streamsize>(frame.data.size())))
+        throw std::runtime_error("Truncated recording");
+
+    return true;
+}
+
+bool RecordingReader::isRecording(const std::filesystem::path& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    char magic[sizeof(RecordingSink::MAGIC)];
+
+    return file.read(magic, sizeof(magic)) && std::equal(magic, magic + sizeof(magic), RecordingSink::MAGIC);
+}
+
+#ifdef _WIN32
+SocketSink::SocketSink(const std::filesystem::path& pathIn, std::size_t maxPendingIn) : path(pathIn), maxPending(maxPendingIn)
+{
+    throw std::runtime_error("Socket output is not supported on this platform");
+}
+
+SocketSink::~SocketSink() = default;
+
+void SocketSink::write(const std::vector<const OutputFrame*>&)
+{
+
+}
+
+#else
+SocketSink::SocketSink(const std::filesystem::path& pathIn, std::size_t maxPendingIn) : path(pathIn), maxPending(maxPendingIn)
+{
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+
+    const std::string name = this->path.string();
+
+    if (name.size() >= sizeof(address.sun_path))
+        throw std::runtime_error("Socket path too long: " + name);
+
+    std::memcpy(address.sun_path, name.c_str(), name.size() + 1);
+
+    // A socket left behind by an earlier run
+    if (std::filesystem::is_socket(this->path))
+        std::filesystem::remove(this->path);
+
+    this->listener = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (this->listener < 0)
+        throwError("Could not create socket");
+
+    if (::bind(this->listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0 || ::listen(this->listener, 16) < 0)
+    {
+        const int bindError = errno;
+        ::close(this->listener);
+        errno = bindError;
+        throwError("Could not listen on " + name);
+    }
+}
+
+SocketSink::~SocketSink()
+{
+    for (const Viewer& viewer : this->viewers)
+        ::close(viewer.fd);
+
+    ::close(this->listener);
+
+    std::error_code ignored;
+    std::filesystem::remove(this->path, ignored);
+}
+
+void SocketSink::write(const std::vector<const OutputFrame*>& frames)
+{
+    this->acceptViewers();
+
+    // Viewers still busy with earlier frames first, a frame is copied at most once for all of them
+    std::vector<bool> gone(this->viewers.size());
+
+    for (std::size_t v = 0; v < this->viewers.size(); v++)
+        gone[v] = !this->sendPending(this->viewers[v]);
+
+    for (const OutputFrame* frame : frames)
+    {
+        std::shared_ptr<const std::string> copy;
+
+        for (std::size_t v = 0; v < this->viewers.size(); v++)
+        {
+            Viewer& viewer = this->viewers[v];
+
+            if (gone[v] || (viewer.waitingForKeyframe && !frame->keyframe))
+                continue;
+
+            viewer.waitingForKeyframe = false;
+            std::size_t sent = 0;
+
+            if (viewer.pending.empty())
+            {
+                if (!this->send(viewer, frame->data.data(), frame->data.size(), sent))
+                {
+                    gone[v] = true;
+                    continue;
+                }
+
+                if (sent == frame->data.size())
+                    continue;
+
+                viewer.offset = sent;
+            }
+
+            if (!copy)
+                copy = std::make_shared<const std::string>(frame->data);
+
+            viewer.pending.push_back(copy);
+            viewer.pendingBytes += frame->data.size() - sent;
+
+            if (viewer.pendingBytes > this->maxPending)
+                this->resync(viewer);
+        }
+    }
+
+    for (std::size_t v = this->viewers.size(); v-- > 0;)
+    {
+        if (gone[v])
+        {
+            ::close(this->viewers[v].fd);
+            this->viewers.erase(this->viewers.begin() + static_cast<std::ptrdiff_t>(v));
+        }
+    }
+
+    this->viewerCount.store(this->viewers.size(), std::memory_order_relaxed);
+}
+
+void SocketSink::acceptViewers()
+{
+    while (true)
+    {
+        const int client = ::accept4(this->listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if (client < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+
+            throwError("Could not accept viewer");
+        }
+
+        Viewer viewer;
+        viewer.fd = client;
+        this->viewers.push_back(std::move(viewer));
+        this->keyframeRequested.store(true, std::memory_order_relaxed);
+    }
+}
+
+bool SocketSink::sendPending(Viewer& viewer)
+{
+    while (!viewer.pending.empty())
+    {
+        const std::string& data = *viewer.pending.front();
+        std::size_t sent = 0;
+
+        if (!this->send(viewer, data.data() + viewer.offset, data.size() - viewer.offset, sent))
+            return false;
+
+        viewer.offset += sent;
+        viewer.pendingBytes -= sent;
+
+        if (viewer.offset < data.size())
+            return true;
+
+        viewer.pending.pop_front();
+        viewer.offset = 0;
+    }
+
+    return true;
+}
+
+bool SocketSink::send(Viewer& viewer, const char* data, std::size_t size, std::size_t& sent)
+{
+    while (sent < size)
+    {
+        const ssize_t result = ::send(viewer.fd, data + sent, size - sent, MSG_NOSIGNAL);
+
+        if (result < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            // Full for now, the rest goes out with the next frames
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+
+        sent += static_cast<std::size_t>(result);
+    }
+
+    return true;
+}
+
+void SocketSink::resync(Viewer& viewer)
+{
+    // A partly sent frame has to be completed, or the viewer would get a torn escape sequence
+    const std::size_t keep = viewer.offset ? 1 : 0;
+
+    while (viewer.pending.size() > keep)
+    {
+        viewer.pendingBytes -= viewer.pending.back()->size();
+        viewer.pending.pop_back();
+    }
+
+    viewer.waitingForKeyframe = true;
+    this->keyframeRequested.store(true, std::memory_order_relaxed);
+}
+#endif
+
+bool SocketSink::takeKeyframeRequest()
+{
+    return this->keyframeRequested.exchange(false, std::memory_order_relaxed);
+}
+
+std::size_t SocketSink::getViewers() const
+{
+    return this->viewerCount.load(std::memory_order_relaxed);
+}
\ No newline at end of file
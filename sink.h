@@ -0,0 +1,177 @@
+#ifndef PNG2BR_SINK_H
+#define PNG2BR_SINK_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// An encoded frame, the same bytes go to every sink
+struct OutputFrame
+{
+    std::string data;
+    // Seconds since the start of the stream
+    double timestamp = 0;
+    // A full redraw that does not depend on earlier frames
+    bool keyframe = false;
+};
+
+/*
+ * Destination of the encoded frame stream. Sinks are driven by a single
+ * thread (see OutputWriter) and get whole frames in presentation order.
+ * Errors are thrown and stop the output.
+ */
+class OutputSink
+{
+    public:
+        virtual ~OutputSink() = default;
+
+        virtual void write(const std::vector<const OutputFrame*>& frames) = 0;
+
+        // True once after the sink started to need a keyframe, e.g. for a viewer that just connected. Any thread
+        virtual bool takeKeyframeRequest();
+};
+
+/*
+ * Writes the raw stream to a file descriptor, e.g. a terminal or a pipe,
+ * with one writev() for all frames where available.
+ */
+class StreamSink : public OutputSink
+{
+    public:
+        // The descriptor is not closed
+        explicit StreamSink(int fdIn);
+
+        void write(const std::vector<const OutputFrame*>& frames) override;
+
+    protected:
+        struct Span
+        {
+            const char* data;
+            std::size_t size;
+        };
+
+        // Writes all spans in order, retrying short writes
+        void writeSpans(std::vector<Span>& spans);
+
+        int fd;
+};
+
+// Standard output, with escape sequences enabled where that is needed
+class TerminalSink : public StreamSink
+{
+    public:
+        TerminalSink();
+};
+
+// Creates or truncates a regular file, opening a named pipe waits for its reader
+class FileSink : public StreamSink
+{
+    public:
+        explicit FileSink(const std::filesystem::path& path);
+
+        FileSink(const FileSink&) = delete;
+        FileSink& operator=(const FileSink&) = delete;
+
+        ~FileSink() override;
+};
+
+/*
+ * Records the frames with their timestamps for later replay:
+ *
+ *     "BRREC001"
+ *     per frame: int64 timestamp in microseconds, uint32 size, uint32 flags (1: keyframe), size bytes
+ *
+ * Numbers are little endian.
+ */
+class RecordingSink : public FileSink
+{
+    public:
+        static constexpr char MAGIC[8] = { 'B', 'R', 'R', 'E', 'C', '0', '0', '1' };
+        static constexpr uint32_t FLAG_KEYFRAME = 1;
+        static constexpr std::size_t RECORD_HEADER_SIZE = 16;
+
+        explicit RecordingSink(const std::filesystem::path& path);
+
+        void write(const std::vector<const OutputFrame*>& frames) override;
+
+    private:
+        std::vector<std::array<char, RECORD_HEADER_SIZE>> headers;
+        bool headerWritten = false;
+};
+
+// Reads back the frames of a RecordingSink in the order they were written
+class RecordingReader
+{
+    public:
+        explicit RecordingReader(const std::filesystem::path& path);
+
+        // Replaces frame with the next one, false at the end of the recording
+        bool next(OutputFrame& frame);
+
+        // Whether the file starts with the recording magic
+        [[nodiscard]] static bool isRecording(const std::filesystem::path& path);
+
+    private:
+        std::ifstream input;
+};
+
+/*
+ * Broadcasts the stream to any number of local viewers connected to a unix
+ * domain socket, e.g. with `socat - UNIX-CONNECT:path`.
+ *
+ * Frames are encoded once: a viewer that can take a frame right away gets it
+ * straight from the frame buffer, otherwise all lagging viewers share one
+ * copy of it. Sockets never block, a viewer falling more than maxPending
+ * bytes behind loses its queued frames. New and resynchronising viewers
+ * only start with the next keyframe, which they request.
+ */
+class SocketSink : public OutputSink
+{
+    public:
+        explicit SocketSink(const std::filesystem::path& pathIn, std::size_t maxPendingIn = 8 * 1024 * 1024);
+
+        SocketSink(const SocketSink&) = delete;
+        SocketSink& operator=(const SocketSink&) = delete;
+
+        ~SocketSink() override;
+
+        void write(const std::vector<const OutputFrame*>& frames) override;
+        bool takeKeyframeRequest() override;
+
+        // Any thread
+        [[nodiscard]] std::size_t getViewers() const;
+
+    private:
+        struct Viewer
+        {
+            int fd = -1;
+            bool waitingForKeyframe = true;
+            // Frames not fully sent yet, the first one from offset on
+            std::deque<std::shared_ptr<const std::string>> pending;
+            std::size_t offset = 0;
+            std::size_t pendingBytes = 0;
+        };
+
+        void acceptViewers();
+        // Sends as much as the socket takes, returns false once the viewer is gone
+        bool sendPending(Viewer& viewer);
+        bool send(Viewer& viewer, const char* data, std::size_t size, std::size_t& sent);
+        void resync(Viewer& viewer);
+
+        std::filesystem::path path;
+        std::size_t maxPending;
+        int listener = -1;
+
+        std::vector<Viewer> viewers;
+        std::atomic<std::size_t> viewerCount{ 0 };
+        std::atomic<bool> keyframeRequested{ false };
+};
+
+#endif //PNG2BR_SINK_H
\ No newline at end of file
@@ -0,0 +1,213 @@
+#ifndef PNG2BR_SPSCRING_H
+#define PNG2BR_SPSCRING_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * Bounded single-producer/single-consumer ring of preallocated slots.
+ *
+ * The producer fills the slot returned by acquire() in place and hands it
+ * over with publish(), the consumer reads front() and releases it with pop().
+ * Both sides only touch their own counter on the fast path, a side only
+ * sleeps (C++20 atomic wait/notify) when the ring is full or empty, and is
+ * only notified if it actually went to sleep.
+ *
+ * Contention and latency counters are kept for diagnostics and may be read
+ * from any thread.
+ */
+template<typename T>
+class SPSCRing
+{
+    public:
+        typedef std::chrono::steady_clock Clock;
+
+        struct Stats
+        {
+            uint64_t items = 0;
+            // Number of times the producer found the ring full / the consumer found it empty, and how long they waited
+            uint64_t fullWaits = 0;
+            uint64_t emptyWaits = 0;
+            std::chrono::nanoseconds fullWaitTime{ 0 };
+            std::chrono::nanoseconds emptyWaitTime{ 0 };
+            // Time from publish() to pop()
+            std::chrono::nanoseconds totalLatency{ 0 };
+            std::chrono::nanoseconds maxLatency{ 0 };
+
+            [[nodiscard]] std::chrono::nanoseconds averageLatency() const
+            {
+                return this->items ? this->totalLatency / static_cast<int64_t>(this->items) : std::chrono::nanoseconds(0);
+            }
+        };
+
+        explicit SPSCRing(std::size_t capacity) : slots(capacity), published(capacity)
+        {
+
+        }
+
+        SPSCRing(const SPSCRing&) = delete;
+        SPSCRing& operator=(const SPSCRing&) = delete;
+
+        [[nodiscard]] std::size_t capacity() const
+        {
+            return this->slots.size();
+        }
+
+        // Number of published items not popped yet
+        [[nodiscard]] std::size_t size() const
+        {
+            return static_cast<std::size_t>(this->tail.load(std::memory_order_acquire) - this->head.load(std::memory_order_acquire));
+        }
+
+        // Producer: the next slot to fill, waits while the ring is full
+        T& acquire()
+        {
+            const uint64_t t = this->tail.load(std::memory_order_relaxed);
+
+            if (t - this->head.load(std::memory_order_acquire) == this->capacity())
+            {
+                auto start = Clock::now();
+
+                this->wait(this->consumerSignal, this->producerWaiting, [&] {
+                    return t - this->head.load(std::memory_order_seq_cst) < this->capacity();
+                });
+
+                this->counters.fullWaits.fetch_add(1, std::memory_order_relaxed);
+                this->counters.fullWaitTime.fetch_add((Clock::now() - start).count(), std::memory_order_relaxed);
+            }
+
+            return this->slots[t % this->capacity()];
+        }
+
+        // Producer: hands the slot returned by acquire() to the consumer
+        void publish()
+        {
+            const uint64_t t = this->tail.load(std::memory_order_relaxed);
+            this->published[t % this->capacity()] = Clock::now();
+            this->tail.store(t + 1, std::memory_order_seq_cst);
+            this->wake(this->producerSignal, this->consumerWaiting);
+        }
+
+        // Producer: no more items will follow, front() returns nullptr once the ring ran empty
+        void close()
+        {
+            this->closed.store(true, std::memory_order_seq_cst);
+            this->wake(this->producerSignal, this->consumerWaiting);
+        }
+
+        // Consumer: the oldest published item, waits while the ring is empty
+        T* front()
+        {
+            const uint64_t h = this->head.load(std::memory_order_relaxed);
+
+            auto ready = [&] {
+                return this->tail.load(std::memory_order_seq_cst) != h || this->closed.load(std::memory_order_seq_cst);
+            };
+
+            if (!ready())
+            {
+                auto start = Clock::now();
+
+                this->wait(this->producerSignal, this->consumerWaiting, ready);
+
+                this->counters.emptyWaits.fetch_add(1, std::memory_order_relaxed);
+                this->counters.emptyWaitTime.fetch_add((Clock::now() - start).count(), std::memory_order_relaxed);
+            }
+
+            if (this->tail.load(std::memory_order_acquire) == h)
+                return nullptr;
+
+            return &this->slots[h % this->capacity()];
+        }
+
+        // Consumer: releases the item returned by front() back to the producer
+        void pop()
+        {
+            const uint64_t h = this->head.load(std::memory_order_relaxed);
+            const int64_t latency = (Clock::now() - this->published[h % this->capacity()]).count();
+
+            this->counters.items.fetch_add(1, std::memory_order_relaxed);
+            this->counters.totalLatency.fetch_add(latency, std::memory_order_relaxed);
+
+            if (latency > this->counters.maxLatency.load(std::memory_order_relaxed))
+                this->counters.maxLatency.store(latency, std::memory_order_relaxed);
+
+            this->head.store(h + 1, std::memory_order_seq_cst);
+            this->wake(this->consumerSignal, this->producerWaiting);
+        }
+
+        [[nodiscard]] Stats getStats() const
+        {
+            Stats stats;
+            stats.items = this->counters.items.load(std::memory_order_relaxed);
+            stats.fullWaits = this->counters.fullWaits.load(std::memory_order_relaxed);
+            stats.emptyWaits = this->counters.emptyWaits.load(std::memory_order_relaxed);
+            stats.fullWaitTime = std::chrono::nanoseconds(this->counters.fullWaitTime.load(std::memory_order_relaxed));
+            stats.emptyWaitTime = std::chrono::nanoseconds(this->counters.emptyWaitTime.load(std::memory_order_relaxed));
+            stats.totalLatency = std::chrono::nanoseconds(this->counters.totalLatency.load(std::memory_order_relaxed));
+            stats.maxLatency = std::chrono::nanoseconds(this->counters.maxLatency.load(std::memory_order_relaxed));
+            return stats;
+        }
+
+    private:
+        // The waiting flag is raised before the condition is checked again and the signal is bumped
+        // after the other side changed its counter, so with sequentially consistent accesses either
+        // the check sees the change or the other side sees the flag and wakes the waiter
+        template<typename Condition>
+        static void wait(std::atomic<uint32_t>& signal, std::atomic<bool>& waiting, Condition done)
+        {
+            while (true)
+            {
+                waiting.store(true, std::memory_order_seq_cst);
+                uint32_t seen = signal.load(std::memory_order_seq_cst);
+
+                if (done())
+                    break;
+
+                signal.wait(seen, std::memory_order_seq_cst);
+            }
+
+            waiting.store(false, std::memory_order_relaxed);
+        }
+
+        static void wake(std::atomic<uint32_t>& signal, std::atomic<bool>& waiting)
+        {
+            if (waiting.load(std::memory_order_seq_cst))
+            {
+                signal.fetch_add(1, std::memory_order_seq_cst);
+                signal.notify_one();
+            }
+        }
+
+        struct Counters
+        {
+            std::atomic<uint64_t> items{ 0 };
+            std::atomic<uint64_t> fullWaits{ 0 };
+            std::atomic<uint64_t> emptyWaits{ 0 };
+            std::atomic<int64_t> fullWaitTime{ 0 };
+            std::atomic<int64_t> emptyWaitTime{ 0 };
+            std::atomic<int64_t> totalLatency{ 0 };
+            std::atomic<int64_t> maxLatency{ 0 };
+        };
+
+        std::vector<T> slots;
+        std::vector<Clock::time_point> published;
+
+        // Written by the consumer
+        alignas(64) std::atomic<uint64_t> head{ 0 };
+        std::atomic<uint32_t> consumerSignal{ 0 };
+        std::atomic<bool> consumerWaiting{ false };
+
+        // Written by the producer
+        alignas(64) std::atomic<uint64_t> tail{ 0 };
+        std::atomic<uint32_t> producerSignal{ 0 };
+        std::atomic<bool> producerWaiting{ false };
+        std::atomic<bool> closed{ false };
+
+        alignas(64) Counters counters;
+};
+
+#endif //PNG2BR_SPSCRING_H
\ No newline at end of file
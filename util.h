@@ -5,6 +5,7 @@
 #ifndef PNG2BR_UTIL_H
 #define PNG2BR_UTIL_H
 
+#include <cstddef>
 #include <cstdint>
 
 struct uvec2
@@ -13,4 +14,26 @@ struct uvec2
     std::uint32_t y;
 };
 
+// File formats are little endian whatever the host
+template<typename T>
+inline void store_le(void* out, T value)
+{
+    auto* bytes = static_cast<unsigned char*>(out);
+
+    for (std::size_t i = 0; i < sizeof(T); i++)
+        bytes[i] = static_cast<unsigned char>(static_cast<std::uint64_t>(value) >> (8 * i));
+}
+
+template<typename T>
+inline T load_le(const void* in)
+{
+    const auto* bytes = static_cast<const unsigned char*>(in);
+    std::uint64_t value = 0;
+
+    for (std::size_t i = 0; i < sizeof(T); i++)
+        value |= static_cast<std::uint64_t>(bytes[i]) << (8 * i);
+
+    return static_cast<T>(value);
+}
+
 #endif //PNG2BR_UTIL_H
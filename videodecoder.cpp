@@ -1,60 +1,255 @@
 #include "videodecoder.h"
 #include "image.h"
 
+#include <algorithm>
 #include <sstream>
 
 extern "C" {
     #include <libavcodec/avcodec.h>
+    #include <libavutil/pixdesc.h>
 }
 
-void VideoDecoder::outputVideoFrame(AVFrame* frm)
+VideoFrame::VideoFrame() : avFrame(av_frame_alloc())
 {
-    this->frameNum++;
+    if (!this->avFrame)
+        throw std::runtime_error("Could not allocate frame");
+}
+
+VideoFrame::VideoFrame(VideoFrame&& other) noexcept :
+        avFrame(other.avFrame), converted(std::move(other.converted)), luma(other.luma), limitedRange(other.limitedRange), pts(other.pts)
+{
+    other.avFrame = nullptr;
+    other.luma = {};
+}
+
+VideoFrame& VideoFrame::operator=(VideoFrame&& other) noexcept
+{
+    if (this == &other)
+        return *this;
+
+    av_frame_free(&this->avFrame);
+
+    this->avFrame = other.avFrame;
+    this->converted = std::move(other.converted);
+    this->luma = other.luma;
+    this->limitedRange = other.limitedRange;
+    this->pts = other.pts;
+    other.avFrame = nullptr;
+    other.luma = {};
+
+    return *this;
+}
 
-    AVFrame* g8Frame = av_frame_alloc();
+VideoFrame::~VideoFrame()
+{
+    av_frame_free(&this->avFrame);
+}
+
+GConstImageView VideoFrame::getLuma() const
+{
+    return this->luma;
+}
+
+bool VideoFrame::isZeroCopy() const
+{
+    return this->avFrame && this->avFrame->data[0] && this->luma.data == this->avFrame->data[0];
+}
+
+bool VideoFrame::isLimitedRange() const
+{
+    return this->limitedRange;
+}
+
+double VideoFrame::getPTS() const
+{
+    return this->pts;
+}
+
+void VideoFrame::release()
+{
+    if (this->avFrame)
+        av_frame_unref(this->avFrame);
+
+    this->luma = {};
+    this->limitedRange = false;
+}
+
+static int get_sws_flags(VideoDecoder::ScaleFilter filter)
+{
+    switch (filter)
+    {
+        case VideoDecoder::ScaleFilter::FastBilinear:
+            return SWS_FAST_BILINEAR;
+        case VideoDecoder::ScaleFilter::Bicubic:
+            return SWS_BICUBIC;
+        case VideoDecoder::ScaleFilter::Area:
+            return SWS_AREA;
+        case VideoDecoder::ScaleFilter::Point:
+            return SWS_POINT;
+        case VideoDecoder::ScaleFilter::Bilinear:
+        default:
+            return SWS_BILINEAR;
+    }
+}
+
+static int get_thread_type(VideoDecoder::Threading threading)
+{
+    switch (threading)
+    {
+        case VideoDecoder::Threading::Frame:
+            return FF_THREAD_FRAME;
+        case VideoDecoder::Threading::Slice:
+            return FF_THREAD_SLICE;
+        case VideoDecoder::Threading::None:
+            return 0;
+        case VideoDecoder::Threading::Auto:
+        default:
+            return FF_THREAD_FRAME | FF_THREAD_SLICE;
+    }
+}
+
+static AVDiscard get_discard(VideoDecoder::Discard discard)
+{
+    switch (discard)
+    {
+        case VideoDecoder::Discard::NonReference:
+            return AVDISCARD_NONREF;
+        case VideoDecoder::Discard::Bidirectional:
+            return AVDISCARD_BIDIR;
+        case VideoDecoder::Discard::NonIntra:
+            return AVDISCARD_NONINTRA;
+        case VideoDecoder::Discard::NonKey:
+            return AVDISCARD_NONKEY;
+        case VideoDecoder::Discard::All:
+            return AVDISCARD_ALL;
+        case VideoDecoder::Discard::None:
+        default:
+            return AVDISCARD_DEFAULT;
+    }
+}
+
+// Formats whose first plane is a tightly packed 8-bit luma plane, e.g. YUV420P or NV12
+static bool has_luma_plane(AVPixelFormat format)
+{
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(format);
+
+    if (!desc || desc->nb_components < 1)
+        return false;
+
+    constexpr uint64_t excluded = AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_BITSTREAM | AV_PIX_FMT_FLAG_FLOAT;
+
+    if (desc->flags & excluded)
+        return false;
+
+    const AVComponentDescriptor& luma = desc->comp[0];
+
+    return luma.plane == 0 && luma.step == 1 && luma.offset == 0 && luma.shift == 0 && luma.depth == 8;
+}
+
+// Gray and the deprecated YUVJ formats are full range whatever the frame's tag says, often unspecified
+static bool is_full_range(const AVFrame* frm)
+{
+    switch (static_cast<AVPixelFormat>(frm->format))
+    {
+        case AV_PIX_FMT_GRAY8:
+        case AV_PIX_FMT_YUVJ411P:
+        case AV_PIX_FMT_YUVJ420P:
+        case AV_PIX_FMT_YUVJ422P:
+        case AV_PIX_FMT_YUVJ440P:
+        case AV_PIX_FMT_YUVJ444P:
+            return true;
+        default:
+            return frm->color_range == AVCOL_RANGE_JPEG;
+    }
+}
+
+void VideoDecoder::scaleVideoFrame(AVFrame* frm, GImage& target)
+{
+    // Let swscale produce the final size directly, no full resolution copy is made
+    int dstWidth = this->outputWidth ? static_cast<int>(this->outputWidth) : frm->width;
+    int dstHeight = this->outputHeight ? static_cast<int>(this->outputHeight) : frm->height;
 
     this->swsContext = sws_getCachedContext(this->swsContext, frm->width, frm->height, static_cast<AVPixelFormat>(frm->format),
-                                            frm->width, frm->height, AV_PIX_FMT_GRAY8,
-                                            SWS_BILINEAR, nullptr, nullptr, nullptr);
+                                            dstWidth, dstHeight, AV_PIX_FMT_GRAY8,
+                                            get_sws_flags(this->outputFilter), nullptr, nullptr, nullptr);
 
-    this->targetImage->realloc_size(frm->width, frm->height);
+    if (!this->swsContext)
+        throw std::runtime_error("Failed to create the scaling context");
 
-    av_image_fill_arrays(g8Frame->data, g8Frame->linesize, this->targetImage->data(), AV_PIX_FMT_GRAY8, frm->width, frm->height, 1);
+    target.realloc_size(dstWidth, dstHeight);
 
-    sws_scale(this->swsContext, frm->data, frm->linesize, 0, frm->height, g8Frame->data, g8Frame->linesize);
+    uint8_t* dstData[4];
+    int dstLinesize[4];
+    av_image_fill_arrays(dstData, dstLinesize, target.data(), AV_PIX_FMT_GRAY8, dstWidth, dstHeight, 1);
 
-    this->frameReady = true;
+    sws_scale(this->swsContext, frm->data, frm->linesize, 0, frm->height, dstData, dstLinesize);
+}
+
+double VideoDecoder::framePTS(const AVFrame* frm) const
+{
+    if (frm->best_effort_timestamp != AV_NOPTS_VALUE)
+        return static_cast<double>(frm->best_effort_timestamp);
+
+    if (frm->pts != AV_NOPTS_VALUE)
+        return static_cast<double>(frm->pts);
+
+    if (frm->pkt_dts != AV_NOPTS_VALUE)
+        return static_cast<double>(frm->pkt_dts);
 
-    av_frame_free(&g8Frame);
+    return static_cast<double>(this->frameNum - 1) / av_q2d(this->video_stream->r_frame_rate) / av_q2d(this->video_stream->time_base);
 }
 
-void VideoDecoder::outputAudioFrame(AVFrame* frm)
+void VideoDecoder::outputVideoFrame(AVFrame* frm)
 {
-    // size_t unpadded_linesize = frm->nb_samples * av_get_bytes_per_sample(static_cast<AVSampleFormat>(frm->format));
-    std::string tsString;
-    tsString.resize(AV_TS_MAX_STRING_SIZE);
-    av_ts_make_time_string(&tsString[0], frm->pts, &audio_dec_ctx->time_base);
+    this->frameNum++;
+
+    // Taken while the frame is still referenced, it is unreferenced before decodeFrame() returns
+    // and the packet may already belong to a later frame
+    this->lastPTS = this->framePTS(frm);
+
+    if (this->targetFrame)
+    {
+        VideoFrame& target = *this->targetFrame;
+        target.release();
 
-    // printf("audio_frame n:%d nb_samples:%d pts:%s\n", audio_frame_count++, frm->nb_samples, tsString.c_str());
+        if (!target.avFrame)
+            target.avFrame = av_frame_alloc();
 
-    /* Write the raw audio data samples of the first plane. This works
-     * fine for packed formats (e.g. AV_SAMPLE_FMT_S16). However,
-     * most audio decoders output planar audio, which uses a separate
-     * plane of audio samples for each channel (e.g. AV_SAMPLE_FMT_S16P).
-     * In other words, this code will write only the first audio channel
-     * in these cases.
-     * You should use libswresample or libavfilter to convert the frm
-     * to packed data. */
+        if (this->lumaPassthrough && frm->linesize[0] > 0 && has_luma_plane(static_cast<AVPixelFormat>(frm->format)))
+        {
+            if (av_frame_ref(target.avFrame, frm) < 0)
+                throw std::runtime_error("Failed to reference the decoded frame");
 
-    // fwrite(frm->extended_data[0], 1, unpadded_linesize, audio_dst_file);
+            target.luma = { target.avFrame->data[0], static_cast<uint32_t>(frm->width), static_cast<uint32_t>(frm->height),
+                            static_cast<std::size_t>(target.avFrame->linesize[0]) };
+            target.limitedRange = !is_full_range(frm);
+        }
+        else
+        {
+            this->scaleVideoFrame(frm, target.converted);
+            target.luma = target.converted.view();
+        }
+
+        target.pts = this->lastPTS;
+    }
+    else
+    {
+        this->scaleVideoFrame(frm, *this->targetImage);
+    }
+
+    this->frameReady = true;
 }
 
-int VideoDecoder::decodePacket(AVCodecContext* dec, const AVPacket* pkt)
+void VideoDecoder::outputAudioFrame(AVFrame* frm)
 {
-    int ret;
+    if (this->audioConsumer)
+        this->audioConsumer(frm);
+}
 
+void VideoDecoder::submitPacket(AVCodecContext* dec, const AVPacket* pkt)
+{
     // submit the packet to the decoder
-    ret = avcodec_send_packet(dec, pkt);
+    int ret = avcodec_send_packet(dec, pkt);
     if (ret < 0)
     {
         char errBuf[AV_ERROR_MAX_STRING_SIZE];
@@ -63,25 +258,35 @@ int VideoDecoder::decodePacket(AVCodecContext* dec, const AVPacket* pkt)
         exceptionBuf << "Error submitting a packet for decoding  (" << errBuf << ")\n";
         throw std::runtime_error(exceptionBuf.str());
     }
+}
 
-    // get all the available frames from the decoder
-    while (ret >= 0)
+bool VideoDecoder::receive(AVCodecContext* dec)
+{
+    int ret = avcodec_receive_frame(dec, this->frame);
+    if (ret < 0)
     {
-        ret = avcodec_receive_frame(dec, this->frame);
-        if (ret < 0)
-        {
-            // those two return values are special and mean there is no output
-            // frame available, but there were no errors during decoding
-            if (ret == AVERROR_EOF || ret == AVERROR(EAGAIN))
-                return 0;
+        // those two return values are special and mean there is no output
+        // frame available, but there were no errors during decoding
+        if (ret == AVERROR_EOF || ret == AVERROR(EAGAIN))
+            return false;
 
-            char errBuf[AV_ERROR_MAX_STRING_SIZE];
-            av_make_error_string(errBuf, AV_ERROR_MAX_STRING_SIZE, ret);
-            std::stringstream exceptionBuf;
-            exceptionBuf << "Error during decoding (" << errBuf << ")\n";
-            throw std::runtime_error(exceptionBuf.str());
-        }
+        char errBuf[AV_ERROR_MAX_STRING_SIZE];
+        av_make_error_string(errBuf, AV_ERROR_MAX_STRING_SIZE, ret);
+        std::stringstream exceptionBuf;
+        exceptionBuf << "Error during decoding (" << errBuf << ")\n";
+        throw std::runtime_error(exceptionBuf.str());
+    }
+
+    return true;
+}
 
+int VideoDecoder::decodePacket(AVCodecContext* dec, const AVPacket* pkt)
+{
+    this->submitPacket(dec, pkt);
+
+    // get all the available frames from the decoder
+    while (this->receive(dec))
+    {
         // write the frame data to output file
         if (dec->codec->type == AVMEDIA_TYPE_VIDEO)
             this->outputVideoFrame(this->frame);
@@ -94,7 +299,7 @@ int VideoDecoder::decodePacket(AVCodecContext* dec, const AVPacket* pkt)
     return 0;
 }
 
-bool VideoDecoder::openCodecContext(int& stream_idx, AVCodecContext*& dec_ctx, AVMediaType type)
+bool VideoDecoder::openCodecContext(int& stream_idx, AVCodecContext*& dec_ctx, AVMediaType type, const DecoderConfig* config)
 {
     AVStream* st;
     const AVCodec* dec;
@@ -136,6 +341,14 @@ bool VideoDecoder::openCodecContext(int& stream_idx, AVCodecContext*& dec_ctx, A
             throw std::runtime_error(exceptionBuf.str());
         }
 
+        if (config)
+        {
+            dec_ctx->thread_count = static_cast<int>(config->threads);
+            dec_ctx->thread_type = get_thread_type(config->threading);
+            dec_ctx->skip_loop_filter = get_discard(config->skipLoopFilter);
+            dec_ctx->lowres = static_cast<int>(std::min<uint32_t>(config->lowres, dec->max_lowres));
+        }
+
         /* Init the decoders */
         if (avcodec_open2(dec_ctx, dec, &opts) < 0)
         {
@@ -144,6 +357,23 @@ bool VideoDecoder::openCodecContext(int& stream_idx, AVCodecContext*& dec_ctx, A
             throw std::runtime_error(exceptionBuf.str());
         }
 
+        // libavcodec resolves an automatic thread count and falls back to a single thread
+        // when the codec supports neither threading type
+        if (config)
+        {
+            this->decoderConfig = *config;
+
+            if (dec_ctx->active_thread_type & FF_THREAD_FRAME)
+                this->decoderConfig.threading = Threading::Frame;
+            else if (dec_ctx->active_thread_type & FF_THREAD_SLICE)
+                this->decoderConfig.threading = Threading::Slice;
+            else
+                this->decoderConfig.threading = Threading::None;
+
+            this->decoderConfig.threads = this->decoderConfig.threading == Threading::None ? 1 : static_cast<uint32_t>(std::max(dec_ctx->thread_count, 1));
+            this->decoderConfig.lowres = static_cast<uint32_t>(dec_ctx->lowres);
+        }
+
         stream_idx = stream_index;
     }
 
@@ -180,7 +410,12 @@ static int get_format_from_sample_fmt(const char** fmt, enum AVSampleFormat samp
     return -1;
 }
 
-VideoDecoder::VideoDecoder(std::filesystem::path& path) : path(path)
+VideoDecoder::VideoDecoder(std::filesystem::path& path) : VideoDecoder(path, DecoderConfig())
+{
+
+}
+
+VideoDecoder::VideoDecoder(std::filesystem::path& path, const DecoderConfig& config) : path(path), decoderConfig(config)
 {
     std::string pathStr = this->path.string();
     const char* srcFilename = pathStr.c_str();
@@ -199,11 +434,19 @@ VideoDecoder::VideoDecoder(std::filesystem::path& path) : path(path)
         throw std::runtime_error("Could not find stream information");
     }
 
-    if (this->openCodecContext(this->video_stream_idx, this->video_dec_ctx, AVMEDIA_TYPE_VIDEO))
+    if (this->openCodecContext(this->video_stream_idx, this->video_dec_ctx, AVMEDIA_TYPE_VIDEO, &config))
         this->video_stream = this->fmt_ctx->streams[this->video_stream_idx];
 
-    if (this->openCodecContext(this->audio_stream_idx, this->audio_dec_ctx, AVMEDIA_TYPE_AUDIO))
-        this->audio_stream = this->fmt_ctx->streams[this->audio_stream_idx];
+    // The audio decoder is only opened once someone consumes the samples, see setAudioConsumer()
+    int audioIdx = av_find_best_stream(this->fmt_ctx, AVMEDIA_TYPE_AUDIO, -1, -1, nullptr, 0);
+
+    if (audioIdx >= 0)
+    {
+        this->audio_stream_idx = audioIdx;
+        this->audio_stream = this->fmt_ctx->streams[audioIdx];
+    }
+
+    this->updateDiscard();
 
     /* dump input information to stderr */
     av_dump_format(this->fmt_ctx, 0, srcFilename, 0);
@@ -225,6 +468,49 @@ VideoDecoder::VideoDecoder(std::filesystem::path& path) : path(path)
     this->packet->size = 0;
 }
 
+void VideoDecoder::setOutputSize(uint32_t width, uint32_t height, ScaleFilter filter)
+{
+    this->outputWidth = width;
+    this->outputHeight = height;
+    this->outputFilter = filter;
+}
+
+bool VideoDecoder::setAudioConsumer(AudioConsumer consumer)
+{
+    this->audioConsumer = std::move(consumer);
+
+    if (!this->audioConsumer)
+        avcodec_free_context(&this->audio_dec_ctx);
+    else if (!this->audio_dec_ctx && this->audio_stream)
+        this->openCodecContext(this->audio_stream_idx, this->audio_dec_ctx, AVMEDIA_TYPE_AUDIO, nullptr);
+
+    this->updateDiscard();
+
+    return this->audio_dec_ctx != nullptr;
+}
+
+void VideoDecoder::setFrameSkip(Discard skip)
+{
+    this->frameSkip.store(skip, std::memory_order_relaxed);
+}
+
+void VideoDecoder::updateDiscard()
+{
+    // Demuxers skip discarded streams where the container allows it, their packets never reach a decoder
+    for (unsigned i = 0; i < this->fmt_ctx->nb_streams; i++)
+    {
+        const int idx = static_cast<int>(i);
+        const bool used = (idx == this->video_stream_idx && this->video_dec_ctx) || (idx == this->audio_stream_idx && this->audio_dec_ctx);
+
+        this->fmt_ctx->streams[i]->discard = used ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+    }
+}
+
+void VideoDecoder::setLumaPassthrough(bool enabled)
+{
+    this->lumaPassthrough = enabled;
+}
+
 VideoDecoder::~VideoDecoder()
 {
     sws_freeContext(this->swsContext);
@@ -239,33 +525,51 @@ VideoDecoder::~VideoDecoder()
 
 bool VideoDecoder::decodeFrame(GImage& image)
 {
-    if (buffersFlushed)
-        return false;
-
-    int ret = av_read_frame(this->fmt_ctx, this->packet);
     this->targetImage = &image;
+    this->targetFrame = nullptr;
 
-    if (ret < 0)
-        return false;
-
-    if (this->packet->stream_index == this->video_stream_idx)
-        ret = this->decodePacket(this->video_dec_ctx, this->packet);
+    return this->decodeNext();
+}
 
-    else if (this->packet->stream_index == this->audio_stream_idx)
-        ret = this->decodePacket(this->audio_dec_ctx, this->packet);
+bool VideoDecoder::decodeFrame(VideoFrame& frame)
+{
+    this->targetImage = nullptr;
+    this->targetFrame = &frame;
 
-    av_packet_unref(this->packet);
+    return this->decodeNext();
+}
 
-    if (ret >= 0)
+bool VideoDecoder::decodeNext()
+{
+    // A packet or the flush at the end may yield several frames, they are handed out one per call
+    // and have to be drained before the next packet is sent
+    if (this->video_dec_ctx && this->receive(this->video_dec_ctx))
+    {
+        this->outputVideoFrame(this->frame);
+        av_frame_unref(this->frame);
         return true;
+    }
 
-    if (this->video_dec_ctx)
-        this->decodePacket(this->video_dec_ctx, nullptr);
+    if (this->buffersFlushed)
+        return false;
 
-    if (this->audio_dec_ctx)
-        this->decodePacket(this->audio_dec_ctx, nullptr);
+    if (this->readPacket(this->packet))
+    {
+        this->sendPacket(this->packet);
+        av_packet_unref(this->packet);
+    }
+    else
+    {
+        this->sendPacket(nullptr);
+        this->buffersFlushed = true;
+    }
+
+    if (this->video_dec_ctx && this->receive(this->video_dec_ctx))
+    {
+        this->outputVideoFrame(this->frame);
+        av_frame_unref(this->frame);
+    }
 
-    this->buffersFlushed = true;
     return true;
 }
 
@@ -278,19 +582,72 @@ bool VideoDecoder::hasFrame() const
 
 double VideoDecoder::getPTS() const
 {
-    if (this->frame->best_effort_timestamp != AV_NOPTS_VALUE)
-        return static_cast<double>(this->frame->best_effort_timestamp);
+    return this->lastPTS;
+}
+
+bool VideoDecoder::readPacket(AVPacket* pkt)
+{
+    return av_read_frame(this->fmt_ctx, pkt) >= 0;
+}
+
+void VideoDecoder::sendPacket(const AVPacket* pkt)
+{
+    if (!pkt)
+    {
+        if (this->video_dec_ctx)
+            this->submitPacket(this->video_dec_ctx, nullptr);
 
-    if (this->packet->pts != AV_NOPTS_VALUE)
-        return static_cast<double>(this->packet->pts);
+        if (this->audio_dec_ctx)
+            this->decodePacket(this->audio_dec_ctx, nullptr);
 
-    if (this->packet->dts != AV_NOPTS_VALUE)
-        return static_cast<double>(this->packet->dts);
+        return;
+    }
 
-    return static_cast<double>(this->frameNum) / av_q2d(this->video_stream->r_frame_rate) / av_q2d(this->video_stream->time_base);
+    if (pkt->stream_index == this->video_stream_idx)
+    {
+        this->video_dec_ctx->skip_frame = get_discard(this->frameSkip.load(std::memory_order_relaxed));
+        this->videoPackets++;
+        this->submitPacket(this->video_dec_ctx, pkt);
+    }
+
+    else if (pkt->stream_index == this->audio_stream_idx && this->audio_dec_ctx)
+        this->decodePacket(this->audio_dec_ctx, pkt);
+}
+
+bool VideoDecoder::receiveFrame(VideoFrame& frame)
+{
+    if (!this->video_dec_ctx || !this->receive(this->video_dec_ctx))
+        return false;
+
+    this->targetImage = nullptr;
+    this->targetFrame = &frame;
+
+    this->outputVideoFrame(this->frame);
+    av_frame_unref(this->frame);
+
+    this->targetFrame = nullptr;
+    this->frameReady = false;
+
+    return true;
 }
 
 double VideoDecoder::getTimeBase() const
 {
     return this->video_stream->time_base.num / static_cast<double>(this->video_stream->time_base.den);
 }
+
+
+const VideoDecoder::DecoderConfig& VideoDecoder::getDecoderConfig() const
+{
+    return this->decoderConfig;
+}
+
+std::string VideoDecoder::getCodecName() const
+{
+    return this->video_dec_ctx ? this->video_dec_ctx->codec->name : "none";
+}
+
+uint64_t VideoDecoder::getSkippedFrames() const
+{
+    return static_cast<uint64_t>(std::max<int64_t>(this->videoPackets - this->frameNum, 0));
+}
\ No newline at end of file
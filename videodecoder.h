@@ -1,7 +1,10 @@
 #ifndef PNG2BR_VIDEODECODER_H
 #define PNG2BR_VIDEODECODER_H
 
+#include <atomic>
 #include <filesystem>
+#include <functional>
+#include <string>
 #include "image.h"
 
 extern "C"
@@ -13,31 +16,155 @@ extern "C"
     #include <libswscale/swscale.h>
 }
 
+/*
+ * A decoded frame as seen by the processing stages. For planar and
+ * semi-planar YUV sources the luma view points straight into the decoder's
+ * Y plane and the AVFrame stays referenced until the frame is released or
+ * reused, other formats are converted into an owned grayscale image.
+ */
+class VideoFrame
+{
+    public:
+        VideoFrame();
+        VideoFrame(VideoFrame&& other) noexcept;
+        VideoFrame& operator=(VideoFrame&& other) noexcept;
+        ~VideoFrame();
+
+        [[nodiscard]] GConstImageView getLuma() const;
+        // True when the luma view references the decoder's Y plane
+        [[nodiscard]] bool isZeroCopy() const;
+        // True when the luma uses the limited 16-235 range, see GImage::limited_range_lut()
+        [[nodiscard]] bool isLimitedRange() const;
+        // In stream time base units, see VideoDecoder::getTimeBase()
+        [[nodiscard]] double getPTS() const;
+        void release();
+
+    private:
+        friend class VideoDecoder;
+
+        AVFrame* avFrame = nullptr;
+        GImage converted;
+        GConstImageView luma{};
+        bool limitedRange = false;
+        double pts = 0;
+};
+
 class VideoDecoder
 {
     public:
+        enum class ScaleFilter
+        {
+            FastBilinear,
+            Bilinear,
+            Bicubic,
+            Area,
+            Point
+        };
+
+        enum class Threading
+        {
+            // Frame threading where the codec supports it, slice threading otherwise
+            Auto,
+            // Decodes several frames at once, adds one frame of latency per thread
+            Frame,
+            // Splits a frame, only helps with streams encoded with several slices
+            Slice,
+            // Reported when the codec decodes on the calling thread
+            None
+        };
+
+        // Which frames a decoding step is skipped for, from the least to the most aggressive
+        enum class Discard
+        {
+            None,
+            NonReference,
+            Bidirectional,
+            NonIntra,
+            NonKey,
+            All
+        };
+
+        struct DecoderConfig
+        {
+            // 0 lets libavcodec pick one per core
+            uint32_t threads = 0;
+            Threading threading = Threading::Auto;
+            // Frames whose in-loop deblocking filter is skipped, faster but blockier
+            Discard skipLoopFilter = Discard::None;
+            // Decodes at 1/2^lowres of the size, clamped to what the codec supports (e.g. MPEG-2/4, MJPEG)
+            uint32_t lowres = 0;
+        };
+
+        // Called on the decoding thread for every decoded audio frame
+        typedef std::function<void(const AVFrame* frame)> AudioConsumer;
+
         explicit VideoDecoder(std::filesystem::path& path);
+        VideoDecoder(std::filesystem::path& path, const DecoderConfig& config);
+        // Scales frames to the given size while converting to grayscale, 0 keeps the source dimension
+        void setOutputSize(uint32_t width, uint32_t height, ScaleFilter filter = ScaleFilter::Bilinear);
+        // Zero-copy luma passthrough for YUV sources when decoding into a VideoFrame, enabled by default
+        void setLumaPassthrough(bool enabled);
+        // Audio is discarded at the demuxer and never decoded unless a consumer is set, nullptr discards it again.
+        // Has to be called before decoding starts, returns false if there is no usable audio stream
+        bool setAudioConsumer(AudioConsumer consumer);
+        // Frames the decoder skips entirely, e.g. NonReference to keep up on slow hosts.
+        // May be called from any thread, takes effect with the next video packet
+        void setFrameSkip(Discard skip);
         [[nodiscard]] bool decodeFrame(GImage& image);
+        [[nodiscard]] bool decodeFrame(VideoFrame& frame);
         [[nodiscard]] bool hasFrame() const;
+        // PTS of the last frame output by decodeFrame() or receiveFrame()
         [[nodiscard]] double getPTS() const;
         [[nodiscard]] double getTimeBase() const;
+        // The configuration the video decoder actually runs with, e.g. the thread count libavcodec picked
+        [[nodiscard]] const DecoderConfig& getDecoderConfig() const;
+        [[nodiscard]] std::string getCodecName() const;
+        // Video packets that did not produce a frame, mostly frames skipped by setFrameSkip().
+        // Only exact once the decoder is flushed, frames still in flight count as skipped until then
+        [[nodiscard]] uint64_t getSkippedFrames() const;
+
+        // Split decoding for pipelines: readPacket() demuxes and may run on a different thread than
+        // sendPacket() and receiveFrame(), which have to be called from the same one.
+        // Returns false at the end of the input
+        [[nodiscard]] bool readPacket(AVPacket* pkt);
+        // Audio packets are decoded right away, nullptr flushes the decoders at the end of the input
+        void sendPacket(const AVPacket* pkt);
+        // Returns false once the video decoder needs more input
+        [[nodiscard]] bool receiveFrame(VideoFrame& frame);
+
         ~VideoDecoder();
 
     private:
-        bool openCodecContext(int& stream_idx, AVCodecContext*& dec_ctx, enum AVMediaType type);
+        bool openCodecContext(int& stream_idx, AVCodecContext*& dec_ctx, enum AVMediaType type, const DecoderConfig* config);
+        void submitPacket(AVCodecContext* dec, const AVPacket* pkt);
+        [[nodiscard]] bool receive(AVCodecContext* dec);
         int decodePacket(AVCodecContext* dec, const AVPacket* packet);
+        [[nodiscard]] double framePTS(const AVFrame* frm) const;
         void outputAudioFrame(AVFrame* frm);
+        void updateDiscard();
         void outputVideoFrame(AVFrame* frm);
+        void scaleVideoFrame(AVFrame* frm, GImage& target);
+        [[nodiscard]] bool decodeNext();
 
         bool buffersFlushed = false;
         mutable bool frameReady = false;
         GImage* targetImage = nullptr;
-        int64_t frameNum = 0;
+        VideoFrame* targetFrame = nullptr;
+        bool lumaPassthrough = true;
+        AudioConsumer audioConsumer;
+        std::atomic<int64_t> frameNum{ 0 };
+        std::atomic<int64_t> videoPackets{ 0 };
+        std::atomic<Discard> frameSkip{ Discard::None };
+        double lastPTS = 0;
 
         std::filesystem::path path;
+        DecoderConfig decoderConfig;
         int video_stream_idx = -1;
         int audio_stream_idx = -1;
         SwsContext* swsContext = nullptr;
+        uint32_t outputWidth = 0;
+        uint32_t outputHeight = 0;
+        ScaleFilter outputFilter = ScaleFilter::Bilinear;
 
         AVFormatContext* fmt_ctx = nullptr;
         AVCodecContext* video_dec_ctx = nullptr;